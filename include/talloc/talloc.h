@@ -29,7 +29,9 @@
 #ifndef TALLOC_H_QYTR1XNS
 #define TALLOC_H_QYTR1XNS
 
+#include <stdbool.h>
 #include <stdio.h>
+#include <stdint.h>
 #include "talloc_config.h"
 
 #define TALLOC_VERSION_MAJOR 1
@@ -48,6 +50,235 @@ extern "C" {
 
 typedef void (*talloc_err_f)(const char *);
 
+/**
+ * @brief Called when system memory obtained by talloc crosses soft limit.
+ * @param allocated Bytes of system memory currently obtained.
+ * @param limit Soft limit.
+ */
+typedef void (*talloc_pressure_f)(size_t allocated, size_t limit);
+
+/**
+ * @def Count of buckets in free block size histogram. Bucket i counts free
+ * blocks with size in range <2^i, 2^(i+1)).
+ */
+#define TALLOC_HISTOGRAM_SIZE 64
+
+/**
+ * @brief Placement policy used to choose free heap block for allocation.
+ */
+typedef enum talloc_policy {
+    // smallest free block which fits, found in size ordered tree
+    TALLOC_POLICY_BEST_FIT = 0,
+    // free block with lowest address which fits
+    TALLOC_POLICY_FIRST_FIT = 1,
+    // first fitting free block after the last allocated one
+    TALLOC_POLICY_NEXT_FIT = 2,
+} talloc_policy_t;
+
+/**
+ * @brief Heap counters used to compare placement policies.
+ */
+typedef struct talloc_heap_stats {
+    talloc_policy_t policy;
+    // heap allocations and frees (pool slabs included)
+    size_t allocations;
+    size_t frees;
+    // searches for free block and count of tree nodes or blocks visited
+    size_t searches;
+    size_t search_steps;
+    // allocations served from quick lists without search
+    size_t quick_hits;
+    // free blocks split by allocation
+    size_t splits;
+    // allocations carved from the tail of the newest system block
+    size_t carves;
+    // system memory returned by talloc_purge and pages given back to system
+    size_t released_bytes;
+    size_t purged_bytes;
+    // free blocks merged with neighbour
+    size_t merges;
+    // allocations mapped directly from system and those served by huge cache
+    size_t huge_allocations;
+    size_t huge_cache_hits;
+} talloc_heap_stats_t;
+
+/**
+ * @brief Counters of background maintenance thread.
+ */
+typedef struct talloc_maintenance_stats {
+    size_t passes;
+    // passes which skipped heap purge because heap was busy
+    size_t skipped;
+    // empty pool slabs returned to heap
+    size_t released_slabs;
+    // allocator state refreshed by the last pass
+    size_t allocated;
+    size_t used;
+    size_t largest_free;
+} talloc_maintenance_stats_t;
+
+/**
+ * @brief Independent heap instance with its own pools and system memory.
+ */
+typedef struct talloc_heap talloc_heap_t;
+
+/**
+ * @brief Savepoint of heap instance created by talloc_mark.
+ */
+typedef struct talloc_mark talloc_mark_t;
+
+/**
+ * @brief Heap in shared memory which can be mapped by more processes.
+ */
+typedef struct talloc_shared talloc_shared_t;
+
+/**
+ * @brief Heap persisted in memory-mapped file.
+ */
+typedef struct talloc_persist talloc_persist_t;
+
+/**
+ * @brief Cache of constructed objects of one type.
+ */
+typedef struct talloc_cache talloc_cache_t;
+
+/**
+ * @brief Object constructor and destructor of cache.
+ */
+typedef void (*talloc_ctor_f)(void *obj);
+typedef void (*talloc_dtor_f)(void *obj);
+
+/**
+ * @def Maximum length of cache name including terminator.
+ */
+#define TALLOC_CACHE_NAME_SIZE 32
+
+typedef struct talloc_cache_stats {
+    char name[TALLOC_CACHE_NAME_SIZE];
+    size_t object_size;
+    size_t slab_count;
+    // objects in all slabs and objects allocated from cache
+    size_t objects;
+    size_t used;
+    size_t allocations;
+    size_t frees;
+    // count of constructor and destructor calls
+    size_t constructed;
+    size_t destroyed;
+    // slabs released by reap
+    size_t reaped_slabs;
+} talloc_cache_stats_t;
+
+/**
+ * @brief One entry of allocation profile passed to talloc_reserve_profile.
+ */
+typedef struct talloc_reservation {
+    size_t size;
+    size_t count;
+} talloc_reservation_t;
+
+/**
+ * @def Allocation trace file starts with this 8 byte magic followed by 32 bit
+ * format version and 32 bit size of one record.
+ */
+#define TALLOC_TRACE_MAGIC "TALTRACE"
+#define TALLOC_TRACE_VERSION 1
+
+typedef enum talloc_trace_op {
+    TALLOC_TRACE_MALLOC = 1,
+    TALLOC_TRACE_REALLOC = 2,
+    TALLOC_TRACE_FREE = 3,
+} talloc_trace_op_t;
+
+/**
+ * @brief One record of allocation trace. Pointer ids are addresses returned
+ * by the allocator, old_id is used only by realloc records.
+ */
+typedef struct talloc_trace_record {
+    // monotonic time in nanoseconds
+    uint64_t time;
+    uint64_t id;
+    uint64_t old_id;
+    uint64_t size;
+    uint32_t thread;
+    uint32_t op;
+} talloc_trace_record_t;
+
+typedef enum talloc_latency_op {
+    TALLOC_LATENCY_MALLOC = 0,
+    TALLOC_LATENCY_FREE = 1,
+    TALLOC_LATENCY_REALLOC = 2,
+    TALLOC_LATENCY_OP_COUNT,
+} talloc_latency_op_t;
+
+/**
+ * @brief Slowest part of allocator reached by measured call.
+ */
+typedef enum talloc_latency_path {
+    // cell taken from (or returned to) pool without new slab
+    TALLOC_PATH_POOL = 0,
+    // new pool slab was created
+    TALLOC_PATH_REFILL = 1,
+    // block found in (or returned to) heap
+    TALLOC_PATH_HEAP = 2,
+    // heap obtained new system memory
+    TALLOC_PATH_GROWTH = 3,
+    TALLOC_PATH_COUNT,
+} talloc_latency_path_t;
+
+// values below 8 have own bucket, every higher power of two is split into 8
+#define TALLOC_LATENCY_BUCKETS 304
+
+/**
+ * @brief Histogram of call durations in cycle counter ticks (TSC on x86,
+ * virtual counter on ARM64, nanoseconds elsewhere).
+ */
+typedef struct talloc_latency_histogram {
+    uint64_t count;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[TALLOC_LATENCY_BUCKETS];
+} talloc_latency_histogram_t;
+
+/**
+ * @brief Heap block description.
+ */
+typedef struct talloc_block_info {
+    uintptr_t address;
+    size_t size;
+    int used;
+} talloc_block_info_t;
+
+/**
+ * @brief Pool slab description. Slab holds cells of one size category.
+ */
+typedef struct talloc_slab_info {
+    uintptr_t address;
+    size_t cell_size;
+    size_t cell_count;
+    size_t used_cells;
+} talloc_slab_info_t;
+
+/**
+ * @brief Snapshot of every heap block and pool slab with fragmentation
+ * metrics computed from free heap blocks.
+ */
+typedef struct talloc_snapshot {
+    talloc_block_info_t *blocks;
+    size_t block_count;
+    talloc_slab_info_t *slabs;
+    size_t slab_count;
+
+    size_t allocated;
+    size_t used;
+    size_t free_bytes;
+    size_t largest_free;
+    // 1 - largest_free / free_bytes
+    double fragmentation;
+    size_t histogram[TALLOC_HISTOGRAM_SIZE];
+} talloc_snapshot_t;
+
 /**
  * @brief Memory allocation.
  * Allocates memory of requested size. Automatic pooling is allowed for objects
@@ -93,6 +324,358 @@ tcalloc(const size_t nelem, const size_t elsize);
 extern TALLOC_EXPORT void
 tfree(void *ptr);
 
+/**
+ * @def Size of header stored in front of every allocated block.
+ */
+#define TALLOC_HEADER_SIZE sizeof(size_t)
+
+/**
+ * @def Size of pool cell used for allocation of size bytes.
+ */
+#define TALLOC_CLASS_CELL_SIZE(size)                                                               \
+    (((((size) < sizeof(void *) ? sizeof(void *) : (size)) + TALLOC_HEADER_SIZE +                  \
+       TALLOC_POOL_GROUP_MULT - 1) /                                                               \
+      TALLOC_POOL_GROUP_MULT) *                                                                    \
+     TALLOC_POOL_GROUP_MULT)
+
+/**
+ * @def Pool size class of allocation with size bytes, both macros are constant
+ * expressions so size class can be resolved at compile time. Class is valid only
+ * when TALLOC_CLASS_POOLED(size) is true.
+ */
+#define TALLOC_SIZE_CLASS(size) (TALLOC_CLASS_CELL_SIZE(size) / TALLOC_POOL_GROUP_MULT - 1)
+#define TALLOC_CLASS_POOLED(size)                                                                  \
+    (TALLOC_USE_POOLS && TALLOC_CLASS_CELL_SIZE(size) <= TALLOC_SMALL_TO)
+
+/**
+ * @brief Allocate cell of pool size class without size lookup.
+ * @param size_class Class obtained by TALLOC_SIZE_CLASS.
+ * @return Pointer to allocated memory block.
+ */
+extern TALLOC_EXPORT void *
+talloc_class_malloc(size_t size_class);
+
+/**
+ * @brief Free cell allocated by talloc_class_malloc with the same size class.
+ * Freeing of null address is valid.
+ * @param ptr Memory to be freed.
+ * @param size_class Class used for allocation.
+ */
+extern TALLOC_EXPORT void
+talloc_class_free(void *ptr, size_t size_class);
+
+/**
+ * @brief Check if pointer points into memory obtained by talloc.
+ * Lookup is done in page map of system memory regions so it is safe to call
+ * with pointers allocated by any other allocator.
+ *
+ * @param ptr Pointer to check.
+ * @return True when memory belongs to talloc.
+ */
+extern TALLOC_EXPORT bool
+talloc_owns(const void *ptr);
+
+/**
+ * @brief Get count of bytes usable in allocated block.
+ * @param ptr Pointer returned by tmalloc, tcalloc or trealloc.
+ * @return Usable size which is at least requested size or 0 when pointer does
+ * not belong to talloc.
+ */
+extern TALLOC_EXPORT size_t
+talloc_usable_size(const void *ptr);
+
+/**
+ * @brief Set limits of system memory obtained by talloc, 0 means no limit.
+ * When soft limit is crossed, pressure callback is called and empty pool slabs
+ * and free heap pages are returned to system. Allocation which would cross hard
+ * limit returns NULL.
+ * Default limits are TALLOC_SOFT_LIMIT and TALLOC_HARD_LIMIT (check the config.h).
+ */
+extern TALLOC_EXPORT void
+talloc_set_limits(size_t soft, size_t hard);
+
+extern TALLOC_EXPORT size_t
+talloc_get_soft_limit(void);
+
+extern TALLOC_EXPORT size_t
+talloc_get_hard_limit(void);
+
+/**
+ * @brief Set callback called on memory pressure. Callback is called from
+ * allocating thread without any allocator lock held.
+ */
+extern TALLOC_EXPORT void
+talloc_set_pressure_func(talloc_pressure_f func);
+
+/**
+ * @brief Reap object caches, return empty pool slabs and free heap memory to system.
+ */
+extern TALLOC_EXPORT void
+talloc_purge(void);
+
+/**
+ * @brief Start background maintenance thread. Every pass (interval with random
+ * jitter of +-25%) releases empty pool slabs, purges heap memory which stayed
+ * free for TALLOC_MAINTENANCE_DECAY passes, periodically asks threads to flush
+ * their cell caches and refreshes maintenance statistics. Pool and heap locks
+ * are only tried, busy parts are skipped until next pass; only returning
+ * released slabs to heap waits for heap lock, with no pool lock held. Thread
+ * caches are flushed by their owner on its next pool call, cells cached by idle
+ * threads stay there (and their slabs are kept) until the thread allocates,
+ * frees or exits. Not available on Windows.
+ *
+ * @param interval_ms Average time between passes.
+ * @return False when thread is already running or cannot be started.
+ */
+extern TALLOC_EXPORT bool
+talloc_maintenance_start(unsigned interval_ms);
+
+/**
+ * @brief Stop background maintenance thread and wait for it.
+ */
+extern TALLOC_EXPORT void
+talloc_maintenance_stop(void);
+
+extern TALLOC_EXPORT void
+talloc_get_maintenance_stats(talloc_maintenance_stats_t *stats);
+
+/**
+ * @brief Set placement policy of the heap. Policy should be set before the
+ * first allocation, changing it later is safe but mixes both placements.
+ * Default policy is TALLOC_HEAP_POLICY (check the config.h).
+ */
+extern TALLOC_EXPORT void
+talloc_set_heap_policy(talloc_policy_t policy);
+
+/**
+ * @brief Read heap counters.
+ * @param stats [out] Counters since start or last talloc_reset_heap_stats.
+ */
+extern TALLOC_EXPORT void
+talloc_get_heap_stats(talloc_heap_stats_t *stats);
+
+/**
+ * @brief Reset heap counters to zero.
+ */
+extern TALLOC_EXPORT void
+talloc_reset_heap_stats(void);
+
+/**
+ * @brief Create heap instance which shares no state (locks, pools, system
+ * memory) with the global allocator and other instances. Threads allocating
+ * from instance bypass thread caches.
+ * @return New heap or NULL when out of memory.
+ */
+extern TALLOC_EXPORT talloc_heap_t *
+talloc_heap_create(void);
+
+/**
+ * @brief Destroy heap instance and return all its memory to system at once,
+ * blocks which were not freed become invalid.
+ */
+extern TALLOC_EXPORT void
+talloc_heap_destroy(talloc_heap_t *heap);
+
+/**
+ * @brief Allocate memory block on heap instance. Block must be freed by
+ * talloc_heap_free with the same heap (not by tfree).
+ */
+extern TALLOC_EXPORT void *
+talloc_heap_malloc(talloc_heap_t *heap, size_t count);
+
+extern TALLOC_EXPORT void
+talloc_heap_free(talloc_heap_t *heap, void *ptr);
+
+/**
+ * @brief Set placement policy of heap instance (see talloc_set_heap_policy).
+ */
+extern TALLOC_EXPORT void
+talloc_heap_set_policy(talloc_heap_t *heap, talloc_policy_t policy);
+
+extern TALLOC_EXPORT void
+talloc_heap_get_stats(talloc_heap_t *heap, talloc_heap_stats_t *stats);
+
+/**
+ * @brief Record state of heap instance, talloc_rewind later discards every
+ * allocation made since. Marks can be nested.
+ * @return Mark or NULL when out of memory.
+ */
+extern TALLOC_EXPORT talloc_mark_t *
+talloc_mark(talloc_heap_t *heap);
+
+/**
+ * @brief Free every block allocated from heap since mark was created, in
+ * O(number of blocks). Memory stays mapped for next allocations. The mark and
+ * all marks created after it are released. Blocks allocated before the mark
+ * stay valid, small blocks allocated before mark and freed after it are set
+ * aside while the mark exists and reused after rewind. Heap must not be used by
+ * other threads meanwhile.
+ */
+extern TALLOC_EXPORT void
+talloc_rewind(talloc_mark_t *mark);
+
+/**
+ * @brief Create heap in shared memory object of fixed size. Named object is
+ * created by shm_open (and must not exist), anonymous one (name is NULL) can be
+ * shared with child processes or by passing talloc_shared_fd to other process.
+ * All allocator metadata is stored in the region as offsets and its lock is a
+ * flag in the region, so every process can map it at different address.
+ * Not supported on Windows.
+ * @return Heap or NULL on failure.
+ */
+extern TALLOC_EXPORT talloc_shared_t *
+talloc_shared_create(const char *name, size_t size);
+
+/**
+ * @brief Map shared heap created by another process under name.
+ */
+extern TALLOC_EXPORT talloc_shared_t *
+talloc_shared_open(const char *name);
+
+/**
+ * @brief Map shared heap of descriptor, descriptor is duplicated.
+ */
+extern TALLOC_EXPORT talloc_shared_t *
+talloc_shared_attach(int fd);
+
+extern TALLOC_EXPORT int
+talloc_shared_fd(talloc_shared_t *shared);
+
+/**
+ * @brief Unmap shared heap from this process, blocks stay allocated for other
+ * processes. Named object is removed by shm_unlink.
+ */
+extern TALLOC_EXPORT void
+talloc_shared_close(talloc_shared_t *shared);
+
+extern TALLOC_EXPORT void *
+talloc_shared_malloc(talloc_shared_t *shared, size_t count);
+
+/**
+ * @brief Free block of shared heap, block can be allocated by another process.
+ */
+extern TALLOC_EXPORT void
+talloc_shared_free(talloc_shared_t *shared, void *ptr);
+
+/**
+ * @brief Convert pointer into shared heap to offset valid in every process.
+ */
+extern TALLOC_EXPORT size_t
+talloc_shared_offset(talloc_shared_t *shared, const void *ptr);
+
+/**
+ * @brief Convert offset to pointer into shared heap mapped by this process.
+ */
+extern TALLOC_EXPORT void *
+talloc_shared_pointer(talloc_shared_t *shared, size_t offset);
+
+/**
+ * @brief Open heap stored in file, new file of size is created when it does
+ * not exist or is empty (size of existing file is used otherwise). Heap
+ * metadata and root object live in the file, so reopening brings back all
+ * blocks and allocator state. When base is set the file must be mapped exactly
+ * there (blocks can then contain raw pointers), otherwise it is mapped at any
+ * address and blocks should refer to each other relatively to
+ * talloc_persist_base. Consistency of existing heap is checked. File can be
+ * opened by one process at a time. Not supported on Windows.
+ * @return Heap or NULL on failure (file is locked, invalid or cannot be mapped
+ * at base).
+ */
+extern TALLOC_EXPORT talloc_persist_t *
+talloc_persist_open(const char *path, size_t size, void *base);
+
+/**
+ * @brief Write all changes to file and wait for completion.
+ */
+extern TALLOC_EXPORT bool
+talloc_persist_sync(talloc_persist_t *persist);
+
+/**
+ * @brief Validate all blocks and free lists of heap.
+ */
+extern TALLOC_EXPORT bool
+talloc_persist_check(talloc_persist_t *persist);
+
+/**
+ * @brief Sync and unmap the heap file.
+ */
+extern TALLOC_EXPORT void
+talloc_persist_close(talloc_persist_t *persist);
+
+extern TALLOC_EXPORT void *
+talloc_persist_malloc(talloc_persist_t *persist, size_t count);
+
+extern TALLOC_EXPORT void
+talloc_persist_free(talloc_persist_t *persist, void *ptr);
+
+/**
+ * @brief Store root object (entry point of persisted data) in heap, NULL clears
+ * the root.
+ */
+extern TALLOC_EXPORT void
+talloc_persist_set_root(talloc_persist_t *persist, void *root);
+
+extern TALLOC_EXPORT void *
+talloc_persist_root(talloc_persist_t *persist);
+
+/**
+ * @brief Address where heap file is mapped in this process.
+ */
+extern TALLOC_EXPORT void *
+talloc_persist_base(talloc_persist_t *persist);
+
+/**
+ * @brief Create cache of objects which stay constructed while they are free.
+ * Constructor is called for all objects of slab when slab is created,
+ * destructor when slab is released by talloc_cache_reap or
+ * talloc_cache_destroy. Objects must be returned to cache in constructed state.
+ * Slabs are heap blocks of TALLOC_CACHE_SLAB_SIZE, the same source pool slabs
+ * come from; pool cells are not used because they are limited to
+ * TALLOC_SMALL_TO bytes and freed cells are shared by all users of the size,
+ * which would lose constructed state.
+ *
+ * @param name Name of cache used in statistics.
+ * @param size Object size.
+ * @param align Object alignment (power of two) or 0 for TALLOC_ALIGNMENT.
+ * @param ctor Constructor or NULL.
+ * @param dtor Destructor or NULL.
+ * @return New cache or NULL.
+ */
+extern TALLOC_EXPORT talloc_cache_t *
+talloc_cache_create(const char *name, size_t size, size_t align, talloc_ctor_f ctor,
+                    talloc_dtor_f dtor);
+
+/**
+ * @brief Allocate constructed object from cache.
+ * @return Object or NULL when memory cannot be obtained.
+ */
+extern TALLOC_EXPORT void *
+talloc_cache_alloc(talloc_cache_t *cache);
+
+/**
+ * @brief Return object to cache it was allocated from, object is not destroyed.
+ * Freeing of null address is valid.
+ */
+extern TALLOC_EXPORT void
+talloc_cache_free(talloc_cache_t *cache, void *obj);
+
+/**
+ * @brief Destroy objects of completely free slabs and release these slabs.
+ * Caches are reaped also on memory pressure and by talloc_purge.
+ * @return Count of released slabs.
+ */
+extern TALLOC_EXPORT size_t
+talloc_cache_reap(talloc_cache_t *cache);
+
+/**
+ * @brief Destroy all objects and the cache. All objects must be freed.
+ */
+extern TALLOC_EXPORT void
+talloc_cache_destroy(talloc_cache_t *cache);
+
+extern TALLOC_EXPORT void
+talloc_cache_get_stats(talloc_cache_t *cache, talloc_cache_stats_t *stats);
+
 /**
  * @brief Preallocate memory block.
  * Allocates new block of system memory using default malloc. Use this method
@@ -104,6 +687,26 @@ tfree(void *ptr);
 extern TALLOC_EXPORT void
 talloc_expand(size_t count);
 
+/**
+ * @brief Prepare memory for count blocks of size before latency-critical
+ * phase. Pooled sizes get slabs with at least count free cells, bigger sizes
+ * get continuous heap space; pages of both are prefaulted so the following
+ * allocations never create slabs or grow the heap. Sizes of at least
+ * TALLOC_HUGE_SIZE are mapped on demand and are not reserved. Reservation is
+ * kept by background maintenance, it's released by talloc_optimize,
+ * talloc_purge or memory pressure.
+ * @return False when memory cannot be obtained.
+ */
+extern TALLOC_EXPORT bool
+talloc_reserve(size_t size, size_t count);
+
+/**
+ * @brief Reserve memory for all entries of size histogram (see talloc_reserve),
+ * heap space for all entries is reserved at once.
+ */
+extern TALLOC_EXPORT bool
+talloc_reserve_profile(const talloc_reservation_t *profile, size_t count);
+
 /**
  * @brief Print free block table into file stream.
  * @param file Appended file stream.
@@ -111,6 +714,43 @@ talloc_expand(size_t count);
 extern TALLOC_EXPORT void
 talloc_print_blocks(FILE *file);
 
+/**
+ * @brief Take snapshot of all heap blocks and pool slabs.
+ * Allocator locks are held only while block descriptions are copied, metrics
+ * are computed after all locks are released. Snapshot memory is allocated
+ * using system malloc.
+ *
+ * @return New snapshot or NULL when system is out of memory.
+ */
+extern TALLOC_EXPORT talloc_snapshot_t *
+talloc_snapshot_take(void);
+
+/**
+ * @brief Release snapshot taken by talloc_snapshot_take.
+ */
+extern TALLOC_EXPORT void
+talloc_snapshot_free(talloc_snapshot_t *snapshot);
+
+/**
+ * @brief Write snapshot as JSON object into file stream.
+ * @return 0 on success, -1 on write error.
+ */
+extern TALLOC_EXPORT int
+talloc_snapshot_write_json(const talloc_snapshot_t *snapshot, FILE *file);
+
+/**
+ * @brief Write snapshot in binary form into file stream.
+ * Stream starts with "TALSNAP1" magic followed by 64 bit header values
+ * (block count, slab count, allocated, used, free bytes, largest free block,
+ * fragmentation as double and histogram), then every block as address, size
+ * and used flag and every slab as address, cell size, cell count and used
+ * cells. All values are 64 bit in native byte order.
+ *
+ * @return 0 on success, -1 on write error.
+ */
+extern TALLOC_EXPORT int
+talloc_snapshot_write_binary(const talloc_snapshot_t *snapshot, FILE *file);
+
 /**
  * @brief Removes unused pools of memory.
  */
@@ -136,6 +776,74 @@ talloc_used();
 extern TALLOC_EXPORT void
 talloc_set_err_func(talloc_err_f func);
 
+#if TALLOC_LATENCY_STATS
+/**
+ * @brief Merge latency histograms of all threads for operation and path.
+ */
+extern TALLOC_EXPORT void
+talloc_get_latency(talloc_latency_op_t op, talloc_latency_path_t path,
+                   talloc_latency_histogram_t *histogram);
+
+/**
+ * @brief Reset histograms of all threads, calls running meanwhile can be lost.
+ */
+extern TALLOC_EXPORT void
+talloc_reset_latency(void);
+#endif
+
+/**
+ * @brief Lowest value counted into bucket of latency histogram.
+ */
+extern TALLOC_EXPORT uint64_t
+talloc_latency_bucket_value(size_t bucket);
+
+/**
+ * @brief Estimate value below which percentile (0-100) of histogram values
+ * lies, result is upper bound of the bucket.
+ */
+extern TALLOC_EXPORT uint64_t
+talloc_latency_percentile(const talloc_latency_histogram_t *histogram, double percentile);
+
+#if TALLOC_PROFILING
+/**
+ * @brief Write sampled profile of live allocations into file descriptor.
+ * Output is in legacy heap profile format readable by pprof. Every sample
+ * carries backtrace captured by tmalloc, pprof scales samples up by
+ * TALLOC_PROFILE_SAMPLE_RATE to estimate real memory usage.
+ *
+ * @param fd Output file descriptor.
+ * @return 0 on success, -1 when profile cannot be written.
+ */
+extern TALLOC_EXPORT int
+talloc_profile_dump(int fd);
+#endif
+
+#if TALLOC_TRACE
+/**
+ * @brief Start recording of allocation trace into file.
+ * Records are buffered per thread, buffer is written into file when it is
+ * full, when owning thread calls talloc_trace_flush or when thread exits.
+ *
+ * @param path Output file path, file is truncated.
+ * @return 0 on success, -1 when file cannot be opened.
+ */
+extern TALLOC_EXPORT int
+talloc_trace_start(const char *path);
+
+/**
+ * @brief Write buffered records of calling thread into trace file.
+ */
+extern TALLOC_EXPORT void
+talloc_trace_flush(void);
+
+/**
+ * @brief Flush records of calling thread and close trace file. Records still
+ * buffered by other threads are dropped.
+ */
+extern TALLOC_EXPORT void
+talloc_trace_stop(void);
+#endif
+
 #if TALLOC_FORCE_RESET
 /**
  * @brief Force free allocated system memory and reset allocator.
@@ -0,0 +1,135 @@
+//*****************************************************************************
+// talloc
+//
+// File:   talloc.hpp
+// Author: Martin Dorazil
+// Date:   19/10/2026
+//
+// Copyright 2017 Martin Dorazil
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+
+#ifndef TALLOC_HPP_B7MZQ2LD
+#define TALLOC_HPP_B7MZQ2LD
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include "talloc.h"
+
+namespace talloc {
+
+/**
+ * @brief Typed allocator of objects of type T.
+ * Size class of T is resolved at compile time so pooled types go directly to
+ * free list of their class without any size lookup. Types bigger than
+ * TALLOC_SMALL_TO fall back to tmalloc. Pool cells and heap blocks are aligned
+ * to TALLOC_ALIGNMENT, so alignment of T up to it needs no other size class.
+ */
+template <typename T> class object_pool {
+public:
+    static_assert(alignof(T) <= TALLOC_ALIGNMENT, "type is over-aligned for talloc");
+
+    static constexpr bool pooled = TALLOC_CLASS_POOLED(sizeof(T));
+    static constexpr std::size_t size_class = TALLOC_SIZE_CLASS(sizeof(T));
+
+    /**
+     * @brief Allocate uninitialized memory for one object.
+     */
+    static T *
+    allocate()
+    {
+        void *mem = pooled ? talloc_class_malloc(size_class) : tmalloc(sizeof(T));
+        if (!mem)
+            throw std::bad_alloc();
+        return static_cast<T *>(mem);
+    }
+
+    /**
+     * @brief Free memory obtained by allocate, no destructor is called.
+     */
+    static void
+    deallocate(T *ptr) noexcept
+    {
+        if (pooled)
+            talloc_class_free(ptr, size_class);
+        else
+            tfree(ptr);
+    }
+
+    /**
+     * @brief Allocate and construct object, memory is released when
+     * constructor throws.
+     */
+    template <typename... Args>
+    static T *
+    create(Args &&... args)
+    {
+        T *mem = allocate();
+        try {
+            return ::new (static_cast<void *>(mem)) T(std::forward<Args>(args)...);
+        } catch (...) {
+            deallocate(mem);
+            throw;
+        }
+    }
+
+    /**
+     * @brief Destroy object created by create. Null pointer is valid.
+     */
+    static void
+    destroy(T *ptr) noexcept
+    {
+        if (!ptr)
+            return;
+        ptr->~T();
+        deallocate(ptr);
+    }
+};
+
+/**
+ * @brief Deleter for std::unique_ptr using sized deallocation of T. Pointer must
+ * point to object of exactly type T.
+ */
+template <typename T> struct deleter {
+    void
+    operator()(T *ptr) const noexcept
+    {
+        object_pool<T>::destroy(ptr);
+    }
+};
+
+template <typename T> using unique_ptr = std::unique_ptr<T, deleter<T>>;
+
+/**
+ * @brief Create object of type T owned by talloc::unique_ptr.
+ */
+template <typename T, typename... Args>
+unique_ptr<T>
+make(Args &&... args)
+{
+    return unique_ptr<T>(object_pool<T>::create(std::forward<Args>(args)...));
+}
+
+} // namespace talloc
+
+#endif /* end of include guard: TALLOC_HPP_B7MZQ2LD */
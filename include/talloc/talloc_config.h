@@ -32,6 +32,7 @@
 #ifdef _MSC_VER
 #else
 #include <stdalign.h>
+#include <stddef.h>
 #endif
 
 /**
@@ -42,6 +43,84 @@
  */
 #define TALLOC_BLOCK_SIZE 4194304 // 4 MB
 
+/**
+ * @def Size of system memory page. Every block of system memory obtained by
+ * talloc is aligned to page size and registered in page map.
+ */
+#define TALLOC_PAGE_SIZE 4096
+
+/**
+ * @def Bytes of virtual address space reserved by every heap on its first
+ * growth. Pages are committed at end of the range as heap grows, so heap is one
+ * continuous region and growth extends last free block in place. Heap falls back
+ * to separate system blocks when range is exhausted or cannot be reserved. Set
+ * 0 to always use separate system blocks.
+ */
+#define TALLOC_HEAP_RESERVE 17179869184ULL // 16 GB
+
+/**
+ * @def Default soft and hard limit of system memory obtained by talloc in bytes,
+ * 0 for unlimited. Both can be changed at runtime by talloc_set_limits.
+ */
+#define TALLOC_SOFT_LIMIT 0
+#define TALLOC_HARD_LIMIT 0
+
+/**
+ * @def Count of background maintenance passes for which free heap block must
+ * stay free before it's returned to system.
+ */
+#define TALLOC_MAINTENANCE_DECAY 4
+
+/**
+ * @def Maximum count of heap blocks visited by one maintenance pass while heap
+ * is locked.
+ */
+#define TALLOC_MAINTENANCE_BUDGET 256
+
+/**
+ * @def Threads are asked to flush their cell caches every n-th maintenance
+ * pass, 0 disables flushing.
+ */
+#define TALLOC_MAINTENANCE_FLUSH_PASSES 16
+
+/**
+ * @def Default placement policy of the heap, one of TALLOC_POLICY_BEST_FIT,
+ * TALLOC_POLICY_FIRST_FIT or TALLOC_POLICY_NEXT_FIT.
+ */
+#define TALLOC_HEAP_POLICY TALLOC_POLICY_BEST_FIT
+
+/**
+ * @def Count of exact-size quick lists of recently freed heap blocks. Freed
+ * block is parked in quick list without coalescing and handed back to the
+ * next allocation of the same size. Set to 0 to coalesce every freed block.
+ */
+#define TALLOC_HEAP_QUICK_BINS 32
+
+/**
+ * @def Maximum count of blocks parked in quick lists. All parked blocks are
+ * coalesced when this count is exceeded or when heap runs out of free blocks.
+ */
+#define TALLOC_HEAP_QUICK_MAX 64
+
+/**
+ * @def Heap allocations of at least this size get their own system mapping
+ * which is unmapped on free instead of being carved from heap block. Set 0 to
+ * serve all sizes from heap blocks.
+ */
+#define TALLOC_HUGE_SIZE 8388608 // 8 MB
+
+/**
+ * @def Bytes of freed huge chunks kept mapped for reuse by next huge allocation
+ * of fitting size. The oldest chunks are unmapped when cache is full. Set 0 to
+ * unmap every freed huge chunk.
+ */
+#define TALLOC_HUGE_CACHE_SIZE 134217728 // 128 MB
+
+/**
+ * @def Milliseconds after which cached huge chunk is unmapped.
+ */
+#define TALLOC_HUGE_CACHE_AGE 2000
+
 /**
  * @def Every allocation with pool allocator is rounded up to next multiply of
  * this value. Objects of same size are in same pool.
@@ -55,6 +134,64 @@
  */
 #define TALLOC_INIT_POOL_SIZE 128
 
+/**
+ * @def Count of shards of every pool size category, must be power of two.
+ * Every thread allocates from its own shard and steals free cells from
+ * neighbouring shards when its shard is empty.
+ */
+#define TALLOC_POOL_SHARDS 4
+
+/**
+ * @def Preferred slab size of object caches in bytes, every slab holds at least
+ * 8 objects.
+ */
+#define TALLOC_CACHE_SLAB_SIZE (64 * 1024)
+
+/**
+ * @def Enable lock-free free lists of pool shards. Cells are pushed and popped
+ * by compare and swap of version tagged list head so preempted thread never
+ * blocks others, only slab refill takes lock.
+ */
+#ifndef TALLOC_POOL_LOCK_FREE
+#define TALLOC_POOL_LOCK_FREE 0
+#endif
+
+/**
+ * @def Count of cache colors of pool slabs. First cell of every new slab of
+ * size category is shifted by next multiple of TALLOC_CACHE_LINE_SIZE so same
+ * cells of different slabs map to different cache sets. Bitmap slabs use their
+ * unused tail, list slabs grow by up to TALLOC_POOL_COLORS - 1 cache lines. Set
+ * 1 to disable coloring.
+ */
+#define TALLOC_POOL_COLORS 4
+
+/**
+ * @def Keep free cells of every pool slab in bitmap instead of free list. Cells
+ * are taken in address order, batch of freed cells is applied as bitwise or and
+ * empty slabs are released one by one. Slabs are aligned to their size so slab
+ * of cell is found by masking its address. Cannot be combined with
+ * TALLOC_POOL_LOCK_FREE.
+ */
+#define TALLOC_POOL_BITMAP 0
+
+/**
+ * @def Size and alignment of bitmap pool slabs in bytes, must be power of two.
+ */
+#define TALLOC_POOL_SLAB_SIZE (64 * 1024)
+
+/**
+ * @def Count of free cells kept per size class in thread cache. Threads pop and
+ * push cells without locking while cache is not empty or full, half of cache
+ * is moved from or to shard at once. Set 0 to disable thread cache.
+ */
+#define TALLOC_TCACHE_SIZE 64
+
+/**
+ * @def Size of CPU cache line. Pool shards are aligned to cache line so
+ * threads using different shards never share one.
+ */
+#define TALLOC_CACHE_LINE_SIZE 64
+
 /**
  * @def Objects with size under this value will be allocated in pools, larger
  * objects will be allocated directly on heap.
@@ -81,7 +218,8 @@
 #define TALLOC_FORCE_RESET 0
 
 /**
- * @brief Enable checking of freeing unallocated memory.
+ * @brief Enable checking of freeing unallocated memory. Freed pointers are
+ * validated using page map of memory obtained from system.
  */
 #define TALLOC_MEM_CHECKING 1
 
@@ -93,4 +231,61 @@
  */
 #define TALLOC_EXCEPTION_HANDLING 1
 
+/**
+ * @brief Enable sampling heap profiler.
+ *
+ * Roughly every TALLOC_PROFILE_SAMPLE_RATE allocated bytes tmalloc captures
+ * backtrace of the caller and keeps it until the allocation is freed. Use
+ * talloc_profile_dump to write live samples in format readable by pprof.
+ */
+#define TALLOC_PROFILING 0
+
+/**
+ * @def Average count of bytes allocated between two samples.
+ */
+#define TALLOC_PROFILE_SAMPLE_RATE 524288 // 512 KB
+
+/**
+ * @def Maximum count of stack frames stored for one sample.
+ */
+#define TALLOC_PROFILE_MAX_DEPTH 32
+
+/**
+ * @brief Enable allocation trace recording.
+ *
+ * Every tmalloc, trealloc and tfree is logged as binary record into per-thread
+ * buffer, buffers are flushed into file opened by talloc_trace_start. Use
+ * talloc_replay tool to replay recorded trace.
+ */
+#define TALLOC_TRACE 0
+
+/**
+ * @def Count of trace records buffered per thread before flush into file.
+ */
+#define TALLOC_TRACE_BUFFER_SIZE 4096
+
+/**
+ * @brief Enable latency histograms.
+ *
+ * Duration of every tmalloc, trealloc and tfree is measured by cycle counter
+ * and counted into per-thread log-bucket histogram of its path (pool hit, slab
+ * refill, heap hit, heap growth). Histograms are merged by talloc_get_latency.
+ */
+#define TALLOC_LATENCY_STATS 0
+
+/**
+ * @brief Enable USDT probes.
+ *
+ * Probes from sys/sdt.h are placed at heap growth, slab refill, block
+ * coalescing, pool optimization, lock contention and large allocations. Probe
+ * is single nop until tracer like bpftrace attaches to it. Linux only, needs
+ * systemtap sdt headers.
+ */
+#define TALLOC_USDT 0
+
+/**
+ * @def Heap allocations of at least this size fire large_alloc probe.
+ */
+#define TALLOC_USDT_LARGE_SIZE 262144 // 256 KB
+
 #endif /* end of include guard: CONFIG_HPP_IF6CXWGS */
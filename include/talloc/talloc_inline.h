@@ -0,0 +1,126 @@
+//*****************************************************************************
+// talloc
+//
+// File:   talloc_inline.h
+// Author: Martin Dorazil
+// Date:   19/10/2026
+//
+// Copyright 2017 Martin Dorazil
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+
+#ifndef TALLOC_INLINE_H_W3KD8QNE
+#define TALLOC_INLINE_H_W3KD8QNE
+
+#include "talloc.h"
+
+// Opt-in header with static inline fast paths of pool allocation. Cells are
+// popped from and pushed to calling thread cache directly in caller code, the
+// slow path (refill, flush, big blocks) stays out of line in the library. Link
+// against talloc_static to get thread cache access without PLT and TLS lookup
+// calls.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @def Count of pool size classes.
+ */
+#define TALLOC_CLASS_COUNT (TALLOC_SMALL_TO / TALLOC_POOL_GROUP_MULT)
+
+typedef struct talloc_tcache_bin {
+    void *head;
+    // count of cells which can still be pushed, 0 also when thread cache of
+    // calling thread is not registered yet
+    size_t space;
+} talloc_tcache_bin_t;
+
+typedef struct talloc_tcache {
+    talloc_tcache_bin_t bins[TALLOC_CLASS_COUNT];
+} talloc_tcache_t;
+
+#if defined(_MSC_VER)
+// thread local data cannot be exported from dll
+#define TALLOC_INLINE_FAST_PATH 0
+#else
+#define TALLOC_INLINE_FAST_PATH                                                                    \
+    (TALLOC_USE_POOLS && TALLOC_TCACHE_SIZE && !TALLOC_PROFILING && !TALLOC_TRACE)
+#endif
+
+#if TALLOC_INLINE_FAST_PATH
+#ifdef __cplusplus
+extern TALLOC_EXPORT thread_local talloc_tcache_t talloc_tcache;
+#else
+extern TALLOC_EXPORT _Thread_local talloc_tcache_t talloc_tcache;
+#endif
+#endif
+
+/**
+ * @brief Inlinable version of tmalloc.
+ */
+static inline void *
+talloc_inline_malloc(size_t count)
+{
+#if TALLOC_INLINE_FAST_PATH
+    if (count && TALLOC_CLASS_POOLED(count)) {
+        talloc_tcache_bin_t *bin = &talloc_tcache.bins[TALLOC_SIZE_CLASS(count)];
+        void *cell = bin->head;
+        if (cell) {
+            bin->head = *(void **)cell;
+            bin->space++;
+            return cell;
+        }
+    }
+#endif
+    return tmalloc(count);
+}
+
+/**
+ * @brief Inlinable version of tfree. Pointer is not checked by page map even
+ * when TALLOC_MEM_CHECKING is enabled, use it only with memory allocated by
+ * talloc.
+ */
+static inline void
+talloc_inline_free(void *ptr)
+{
+#if TALLOC_INLINE_FAST_PATH
+    if (!ptr)
+        return;
+    const size_t size = ((const size_t *)ptr)[-1];
+    if (size <= TALLOC_SMALL_TO) {
+        talloc_tcache_bin_t *bin = &talloc_tcache.bins[size / TALLOC_POOL_GROUP_MULT - 1];
+        if (bin->space) {
+            *(void **)ptr = bin->head;
+            bin->head = ptr;
+            bin->space--;
+            return;
+        }
+    }
+#endif
+    tfree(ptr);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end of include guard: TALLOC_INLINE_H_W3KD8QNE */
@@ -0,0 +1,351 @@
+//*****************************************************************************
+// talloc
+//
+// File:   cache.c
+// Author: Martin Dorazil
+// Date:   19/10/2026
+//
+// Copyright 2017 Martin Dorazil
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "cache.h"
+#include "heap.h"
+#include "types.h"
+#include "utils.h"
+
+typedef struct object_meta {
+    struct slab *slab;
+    // next free object in slab, objects keep constructed state so link is not
+    // stored in object itself
+    struct object_meta *next;
+} object_meta_t;
+
+typedef struct slab {
+    struct slab *next;
+    struct slab *prev;
+    talloc_cache_t *cache;
+    object_meta_t *free;
+    size_t free_count;
+} slab_t;
+
+struct talloc_cache {
+    struct talloc_cache *next;
+    struct talloc_cache *prev;
+    tatomic_bool flag;
+    size_t align;
+    // distance of objects in slab
+    size_t stride;
+    size_t slab_objects;
+    size_t slab_size;
+    talloc_ctor_f ctor;
+    talloc_dtor_f dtor;
+    // slabs with some free objects, without free objects and completely free
+    slab_t *partial;
+    slab_t *full;
+    slab_t *empty;
+    talloc_cache_stats_t stats;
+    // slabs taken by cache_reap_all whose destructors did not run yet, cache
+    // destroyed meanwhile is freed by the last of them
+    size_t pending;
+    bool destroyed;
+};
+
+#define OBJECT_META_SIZE sizeof(object_meta_t)
+#define GET_OBJECT_META(obj) ((object_meta_t *)(obj)-1)
+#define ALIGN_UP(n, align) (((n) + (align)-1) & ~(uintptr_t)((align)-1))
+
+static tatomic_bool caches_flag;
+static talloc_cache_t *caches;
+
+static void
+slab_push(slab_t **list, slab_t *slab)
+{
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list)
+        (*list)->prev = slab;
+    *list = slab;
+}
+
+static void
+slab_remove(slab_t **list, slab_t *slab)
+{
+    if (slab->prev)
+        slab->prev->next = slab->next;
+    else
+        *list = slab->next;
+    if (slab->next)
+        slab->next->prev = slab->prev;
+}
+
+// list of slab is given by count of its free objects
+static slab_t **
+slab_list(talloc_cache_t *cache, size_t free_count)
+{
+    if (!free_count)
+        return &cache->full;
+    if (free_count == cache->slab_objects)
+        return &cache->empty;
+    return &cache->partial;
+}
+
+static void *
+first_object(const talloc_cache_t *cache, slab_t *slab)
+{
+    return (void *)ALIGN_UP((uintptr_t)(slab + 1) + OBJECT_META_SIZE, cache->align);
+}
+
+// allocate slab and construct all its objects
+static slab_t *
+new_slab(talloc_cache_t *cache)
+{
+    slab_t *slab = heap_malloc(&global_heap, cache->slab_size);
+    if (!slab)
+        return NULL;
+    slab->cache = cache;
+    slab->free = NULL;
+    slab->free_count = cache->slab_objects;
+
+    byte_t *obj = first_object(cache, slab);
+    obj += (cache->slab_objects - 1) * cache->stride;
+    for (size_t i = 0; i < cache->slab_objects; i++, obj -= cache->stride) {
+        object_meta_t *meta = GET_OBJECT_META(obj);
+        meta->slab = slab;
+        meta->next = slab->free;
+        slab->free = meta;
+        if (cache->ctor)
+            cache->ctor(obj);
+    }
+    return slab;
+}
+
+static void
+release_slab(talloc_cache_t *cache, slab_t *slab)
+{
+    if (cache->dtor) {
+        byte_t *obj = first_object(cache, slab);
+        for (size_t i = 0; i < cache->slab_objects; i++, obj += cache->stride)
+            cache->dtor(obj);
+    }
+    heap_free(&global_heap, slab);
+}
+
+talloc_cache_t *
+talloc_cache_create(const char *name, size_t size, size_t align, talloc_ctor_f ctor,
+                    talloc_dtor_f dtor)
+{
+    if (!align)
+        align = TALLOC_ALIGNMENT;
+    if (align & (align - 1))
+        return NULL;
+    if (align < sizeof(void *))
+        align = sizeof(void *);
+    if (!size)
+        size = 1;
+
+    talloc_cache_t *cache = calloc(1, sizeof(talloc_cache_t));
+    if (!cache)
+        return NULL;
+    if (name)
+        strncpy(cache->stats.name, name, TALLOC_CACHE_NAME_SIZE - 1);
+    cache->stats.object_size = size;
+    cache->align = align;
+    cache->stride = ALIGN_UP(size + OBJECT_META_SIZE, align);
+    cache->slab_objects = (TALLOC_CACHE_SLAB_SIZE - sizeof(slab_t)) / cache->stride;
+    if (cache->slab_objects < 8)
+        cache->slab_objects = 8;
+    // slab start is aligned to TALLOC_ALIGNMENT, first object can need padding
+    cache->slab_size = sizeof(slab_t) + OBJECT_META_SIZE + align + cache->slab_objects * cache->stride;
+    cache->ctor = ctor;
+    cache->dtor = dtor;
+
+    LOCK(caches_flag);
+    cache->next = caches;
+    if (caches)
+        caches->prev = cache;
+    caches = cache;
+    UNLOCK(caches_flag);
+    return cache;
+}
+
+void *
+talloc_cache_alloc(talloc_cache_t *cache)
+{
+    LOCK(cache->flag);
+    slab_t *slab = cache->partial ? cache->partial : cache->empty;
+    if (!slab) {
+        // constructors run without lock
+        UNLOCK(cache->flag);
+        slab = new_slab(cache);
+        if (!slab)
+            return NULL;
+        LOCK(cache->flag);
+        slab_push(&cache->empty, slab);
+        cache->stats.slab_count++;
+        cache->stats.objects += cache->slab_objects;
+        cache->stats.constructed += cache->slab_objects;
+    }
+
+    slab_remove(slab_list(cache, slab->free_count), slab);
+    object_meta_t *meta = slab->free;
+    slab->free = meta->next;
+    slab->free_count--;
+    slab_push(slab_list(cache, slab->free_count), slab);
+    cache->stats.used++;
+    cache->stats.allocations++;
+    UNLOCK(cache->flag);
+    return meta + 1;
+}
+
+void
+talloc_cache_free(talloc_cache_t *cache, void *obj)
+{
+    if (!obj)
+        return;
+    object_meta_t *meta = GET_OBJECT_META(obj);
+    slab_t *slab = meta->slab;
+#if TALLOC_MEM_CHECKING
+    if (slab->cache != cache) {
+        ABORT("object being freed was not allocated from this cache");
+    }
+#endif
+
+    LOCK(cache->flag);
+    slab_remove(slab_list(cache, slab->free_count), slab);
+    meta->next = slab->free;
+    slab->free = meta;
+    slab->free_count++;
+    slab_push(slab_list(cache, slab->free_count), slab);
+    cache->stats.used--;
+    cache->stats.frees++;
+    UNLOCK(cache->flag);
+}
+
+// take empty slabs out of cache and count them as reaped, cache must be locked
+static slab_t *
+take_empty(talloc_cache_t *cache, size_t *count)
+{
+    slab_t *slab = cache->empty;
+    cache->empty = NULL;
+    *count = 0;
+    for (slab_t *current = slab; current; current = current->next)
+        (*count)++;
+    cache->stats.slab_count -= *count;
+    cache->stats.objects -= *count * cache->slab_objects;
+    cache->stats.destroyed += *count * cache->slab_objects;
+    cache->stats.reaped_slabs += *count;
+    return slab;
+}
+
+size_t
+talloc_cache_reap(talloc_cache_t *cache)
+{
+    size_t count;
+    LOCK(cache->flag);
+    slab_t *slab = take_empty(cache, &count);
+    UNLOCK(cache->flag);
+
+    // destructors run without lock
+    while (slab) {
+        slab_t *next = slab->next;
+        release_slab(cache, slab);
+        slab = next;
+    }
+    return count;
+}
+
+void
+talloc_cache_destroy(talloc_cache_t *cache)
+{
+    if (!cache)
+        return;
+    LOCK(caches_flag);
+    if (cache->prev)
+        cache->prev->next = cache->next;
+    else
+        caches = cache->next;
+    if (cache->next)
+        cache->next->prev = cache->prev;
+    UNLOCK(caches_flag);
+
+    talloc_cache_reap(cache);
+#if TALLOC_MEM_CHECKING
+    if (cache->partial || cache->full) {
+        ABORT("cache destroyed with allocated objects");
+    }
+#endif
+    LOCK(cache->flag);
+    cache->destroyed = true;
+    const bool unused = !cache->pending;
+    UNLOCK(cache->flag);
+    if (unused)
+        free(cache);
+}
+
+void
+talloc_cache_get_stats(talloc_cache_t *cache, talloc_cache_stats_t *stats)
+{
+    LOCK(cache->flag);
+    *stats = cache->stats;
+    UNLOCK(cache->flag);
+}
+
+size_t
+cache_reap_all(void)
+{
+    // empty slabs of all caches are taken under lock, destructors run after
+    // unlock so they can allocate or create and destroy caches
+    slab_t *reaped = NULL;
+    size_t count = 0;
+    LOCK(caches_flag);
+    for (talloc_cache_t *cache = caches; cache; cache = cache->next) {
+        size_t n;
+        LOCK(cache->flag);
+        slab_t *slab = take_empty(cache, &n);
+        cache->pending += n;
+        UNLOCK(cache->flag);
+        if (!slab)
+            continue;
+        slab_t *last = slab;
+        while (last->next)
+            last = last->next;
+        last->next = reaped;
+        reaped = slab;
+        count += n;
+    }
+    UNLOCK(caches_flag);
+
+    while (reaped) {
+        slab_t *next = reaped->next;
+        talloc_cache_t *cache = reaped->cache;
+        release_slab(cache, reaped);
+        LOCK(cache->flag);
+        const bool unused = !--cache->pending && cache->destroyed;
+        UNLOCK(cache->flag);
+        if (unused)
+            free(cache);
+        reaped = next;
+    }
+    return count;
+}
@@ -26,35 +26,54 @@
 // SOFTWARE.
 //*****************************************************************************
 
+#ifdef __linux__
+// mremap
+#define _GNU_SOURCE
+#endif
 #include <stdlib.h>
 #include <stdio.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <time.h>
+#endif
 #include "heap.h"
 #include "talloc/talloc_config.h"
 #include "utils.h"
 #include "types.h"
-#if TALLOC_FORCE_RESET
-#include "vector.h"
-#endif
+#include "pagemap.h"
+#include "latency.h"
 
 typedef struct free_meta {
     struct free_meta *next;
     struct free_meta *prev;
     bool used;
-    uintptr_t check;
+    // used block parked in quick list
+    bool quick;
+    // pages behind header of free block were given back to system
+    bool purged;
+    // block is whole system mapping of its own
+    bool huge;
+    // generation of heap in which block was allocated
+    unsigned generation;
     size_t size;
     // additional data for free blocks
     struct free_meta *left;
     struct free_meta *right;
     int height;
+    // purge epoch in which block became free
+    unsigned epoch;
 } free_meta_t;
 
 typedef struct alloc_meta {
     struct free_meta *next;
     struct free_meta *prev;
     bool used;
-#if TALLOC_MEM_CHECKING
-    uintptr_t check;
-#endif
+    bool quick;
+    bool purged;
+    bool huge;
+    unsigned generation;
     size_t size;
 } alloc_meta_t;
 
@@ -67,15 +86,89 @@ typedef struct alloc_meta {
         (size) += TALLOC_ALIGNMENT - ((size) % TALLOC_ALIGNMENT);                                  \
     }
 
-static tatomic_bool heap_flag;
-static free_meta_t list_head;
-static free_meta_t *free_tree_head;
+#if TALLOC_HEAP_QUICK_BINS
+// exact-size list of parked blocks linked through left pointer
+typedef struct quick_bin {
+    size_t size;
+    free_meta_t *head;
+} quick_bin_t;
 
-#if TALLOC_FORCE_RESET
-static vector_t sys_alloc_buffer;
+#define SIZE_TO_QUICK_BIN(s) (((s) / TALLOC_ALIGNMENT) % TALLOC_HEAP_QUICK_BINS)
+#endif
+
+#if TALLOC_HEAP_RESERVE
+#define RANGE_SIZE                                                                                 \
+    ((size_t)(TALLOC_HEAP_RESERVE < SIZE_MAX / 4 ? TALLOC_HEAP_RESERVE : SIZE_MAX / 4))
 #endif
 
-static size_t allocated, used;
+#if TALLOC_HUGE_SIZE && TALLOC_HUGE_CACHE_SIZE
+// bin i holds chunks from TALLOC_HUGE_SIZE << i, last one is unbounded
+#define HUGE_BINS 8
+
+// freed huge chunk kept mapped, record lives behind its header
+typedef struct huge_cached {
+    struct huge_cached *next;
+    span_t *span;
+    // time of free in milliseconds
+    uint64_t freed;
+} huge_cached_t;
+#endif
+
+struct heap {
+    tatomic_bool flag;
+    free_meta_t list_head;
+    free_meta_t *free_tree_head;
+    // regions of system memory
+    span_t *spans;
+    size_t allocated, used;
+    // count of blocks in list
+    size_t block_count;
+    // limits of system memory obtained by heap, 0 for unlimited
+    size_t soft_limit;
+    size_t hard_limit;
+    talloc_policy_t policy;
+    // next fit starts search here
+    free_meta_t *rover;
+    // tail of the newest system block, kept out of the free tree and carved by
+    // pointer bump when the tree has no block big enough
+    free_meta_t *wilderness;
+    // incremental purge continues from here
+    free_meta_t *purge_cursor;
+    unsigned purge_epoch;
+    // wilderness was reserved and prefaulted, incremental purge skips it
+    bool reserved;
+    // stamped into allocated blocks, incremented by mark
+    unsigned generation;
+#if TALLOC_HEAP_RESERVE
+    // committed part of virtual range reserved at first growth
+    span_t range;
+    uintptr_t range_limit;
+    void *range_base;
+    bool range_failed;
+#endif
+    talloc_heap_stats_t stats;
+#if TALLOC_HEAP_QUICK_BINS
+    quick_bin_t quick_bins[TALLOC_HEAP_QUICK_BINS];
+    size_t quick_count;
+#endif
+#if TALLOC_HUGE_SIZE
+    // chunks mapped directly for huge allocations
+    span_t *huge_spans;
+    size_t huge_count;
+#if TALLOC_HUGE_CACHE_SIZE
+    huge_cached_t *huge_bins[HUGE_BINS];
+    // bytes of cached chunks
+    size_t huge_cached;
+#endif
+#endif
+};
+
+heap_t global_heap = {
+    .soft_limit = TALLOC_SOFT_LIMIT,
+    .hard_limit = TALLOC_HARD_LIMIT,
+    .policy = TALLOC_HEAP_POLICY,
+};
+tatomic_bool heap_pressure;
 
 //*****************************************************************************
 // TREE
@@ -272,16 +365,14 @@ insert_node(free_meta_t *node, free_meta_t *new_node)
 }
 
 static free_meta_t *
-find_free_node(free_meta_t *node, size_t size)
+find_free_node(heap_t *heap, size_t size)
 {
-    if (!node)
-        return NULL;
-
-    free_meta_t *current = node;
+    free_meta_t *current = heap->free_tree_head;
     free_meta_t *best_fit = NULL;
     size_t node_size = 0;
 
     while (current) {
+        heap->stats.search_steps++;
         node_size = current->size;
         if (size <= node_size) {
             // can fit
@@ -294,6 +385,36 @@ find_free_node(free_meta_t *node, size_t size)
     return best_fit;
 }
 
+// lowest address free block which fits
+static free_meta_t *
+first_fit(heap_t *heap, free_meta_t *from, free_meta_t *to, size_t size)
+{
+    for (free_meta_t *current = from; current != to; current = current->next) {
+        heap->stats.search_steps++;
+        if (!current->used && current != heap->wilderness && current->size >= size)
+            return current;
+    }
+    return NULL;
+}
+
+static free_meta_t *
+find_block(heap_t *heap, size_t size)
+{
+    heap->stats.searches++;
+    switch (heap->policy) {
+    case TALLOC_POLICY_FIRST_FIT:
+        return first_fit(heap, heap->list_head.next, NULL, size);
+    case TALLOC_POLICY_NEXT_FIT: {
+        free_meta_t *start = heap->rover ? heap->rover : heap->list_head.next;
+        free_meta_t *block = first_fit(heap, start, NULL, size);
+        // wrap around
+        return block ? block : first_fit(heap, heap->list_head.next, start, size);
+    }
+    default:
+        return find_free_node(heap, size);
+    }
+}
+
 // static void print_tree(FILE *file, free_meta_t *node)
 //{
 //    if (!node)
@@ -314,12 +435,12 @@ find_free_node(free_meta_t *node, size_t size)
 //*****************************************************************************
 
 static inline void
-insert_block(free_meta_t *prev, free_meta_t *next, free_meta_t *block);
+insert_block(heap_t *heap, free_meta_t *prev, free_meta_t *next, free_meta_t *block);
 static inline void
-remove_block(free_meta_t *block);
+remove_block(heap_t *heap, free_meta_t *block);
 
 void
-insert_block(free_meta_t *prev, free_meta_t *next, free_meta_t *block)
+insert_block(heap_t *heap, free_meta_t *prev, free_meta_t *next, free_meta_t *block)
 {
     if (prev)
         prev->next = block;
@@ -327,24 +448,25 @@ insert_block(free_meta_t *prev, free_meta_t *next, free_meta_t *block)
         next->prev = block;
     block->prev = prev;
     block->next = next;
+    heap->block_count++;
 }
 
 void
-insert_block_sorted(free_meta_t *block)
+insert_block_sorted(heap_t *heap, free_meta_t *block)
 {
-    free_meta_t *current = list_head.next;
-    free_meta_t *prev = &list_head;
+    free_meta_t *current = heap->list_head.next;
+    free_meta_t *prev = &heap->list_head;
 
     while (current && (block > current)) {
         ASSERT(current != current->next, "memory corrupted");
         prev = current;
         current = current->next;
     }
-    insert_block(prev, current, block);
+    insert_block(heap, prev, current, block);
 }
 
 void
-remove_block(free_meta_t *block)
+remove_block(heap_t *heap, free_meta_t *block)
 {
     free_meta_t *prev = block->prev;
     free_meta_t *next = block->next;
@@ -352,32 +474,235 @@ remove_block(free_meta_t *block)
         prev->next = next;
     if (next)
         next->prev = prev;
+    if (heap->purge_cursor == block)
+        heap->purge_cursor = next;
+    heap->block_count--;
 }
 //*****************************************************************************
 
+static void *
+sys_alloc(size_t size)
+{
+#ifdef _MSC_VER
+    return _aligned_malloc(size, TALLOC_PAGE_SIZE);
+#else
+    void *mem = NULL;
+    if (posix_memalign(&mem, TALLOC_PAGE_SIZE, size))
+        return NULL;
+    return mem;
+#endif
+}
+
+static void
+sys_free(void *mem)
+{
+#ifdef _MSC_VER
+    _aligned_free(mem);
+#else
+    free(mem);
+#endif
+}
+
+// give physical pages back to system, range stays mapped and reads as zeros
+static void
+sys_purge(void *mem, size_t size)
+{
+#if defined(__linux__)
+    madvise(mem, size, MADV_DONTNEED);
+#elif defined(MADV_FREE)
+    madvise(mem, size, MADV_FREE);
+#else
+    (void)mem, (void)size;
+#endif
+}
+
+#if TALLOC_HEAP_RESERVE
+//*****************************************************************************
+// VIRTUAL RANGE
+//*****************************************************************************
+
+static void *
+sys_reserve(size_t size)
+{
+#ifdef _WIN32
+    return VirtualAlloc(NULL, size, MEM_RESERVE, PAGE_NOACCESS);
+#else
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE;
+#endif
+    void *mem = mmap(NULL, size, PROT_NONE, flags, -1, 0);
+    return mem == MAP_FAILED ? NULL : mem;
+#endif
+}
+
+static void
+sys_release(void *mem, size_t size)
+{
+#ifdef _WIN32
+    (void)size;
+    VirtualFree(mem, 0, MEM_RELEASE);
+#else
+    munmap(mem, size);
+#endif
+}
+
+static bool
+sys_commit(void *mem, size_t size)
+{
+#ifdef _WIN32
+    return VirtualAlloc(mem, size, MEM_COMMIT, PAGE_READWRITE) != NULL;
+#else
+    return !mprotect(mem, size, PROT_READ | PROT_WRITE);
+#endif
+}
+
+// give pages back to system and make them inaccessible again
+static void
+sys_decommit(void *mem, size_t size)
+{
+#ifdef _WIN32
+    VirtualFree(mem, size, MEM_DECOMMIT);
+#else
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED;
+#ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE;
+#endif
+    mmap(mem, size, PROT_NONE, flags, -1, 0);
+#endif
+}
+
+static bool
+reserve_range(heap_t *heap)
+{
+    if (heap->range_failed)
+        return false;
+    void *base = sys_reserve(RANGE_SIZE + TALLOC_PAGE_SIZE);
+    if (!base) {
+        heap->range_failed = true;
+        return false;
+    }
+    heap->range_base = base;
+    heap->range.begin = NEXT_MULT_OF((uintptr_t)base, TALLOC_PAGE_SIZE);
+    heap->range.end = heap->range.begin;
+    heap->range.kind = SPAN_HEAP;
+    heap->range.heap = heap;
+    heap->range_limit = heap->range.begin + RANGE_SIZE;
+    return true;
+}
+
+static free_meta_t *
+can_merge_prev(free_meta_t *block);
+
+// commit size bytes at end of range, free block ending there grows in place
 static free_meta_t *
-new_space(size_t size)
+grow_range(heap_t *heap, size_t size)
 {
-    if (size < TALLOC_BLOCK_SIZE)
-        size = TALLOC_BLOCK_SIZE;
+    span_t *range = &heap->range;
+    if (!range->begin && !reserve_range(heap))
+        return NULL;
+    if (heap->range_limit - range->end < size || !sys_commit((void *)range->end, size))
+        return NULL;
 
-    free_meta_t *new_block = (free_meta_t *)malloc(size);
-    if (!new_block)
-        ABORT("bad allocation");
+    free_meta_t *new_block = (free_meta_t *)range->end;
+    pagemap_set(range->end, range->end + size, range);
+    range->end += size;
+    LATENCY_PATH(TALLOC_PATH_GROWTH);
+    PROBE2(new_space, (void *)new_block, size);
+    heap->allocated += size;
+    if (heap->soft_limit && heap->allocated > heap->soft_limit)
+        tatomic_store(&heap_pressure, true);
 
     new_block->size = size;
     new_block->used = false;
-    insert_block_sorted(new_block);
-    free_tree_head = insert_node(free_tree_head, new_block);
+    new_block->quick = false;
+    new_block->purged = false;
+    new_block->huge = false;
+    new_block->epoch = heap->purge_epoch;
+    insert_block_sorted(heap, new_block);
+
+    free_meta_t *prev = can_merge_prev(new_block);
+    if (prev) {
+        remove_block(heap, new_block);
+        if (prev == heap->wilderness) {
+            prev->size += size;
+            return prev;
+        }
+        heap->free_tree_head = remove_node(heap->free_tree_head, prev);
+        prev->size += size;
+        heap->stats.merges++;
+        new_block = prev;
+    }
+    if (heap->wilderness)
+        heap->free_tree_head = insert_node(heap->free_tree_head, heap->wilderness);
+    heap->wilderness = new_block;
+    return new_block;
+}
+//*****************************************************************************
+#endif
 
-#if TALLOC_FORCE_RESET
-    // store for future free
-    if (sys_alloc_buffer.data == NULL)
-        vector_init(&sys_alloc_buffer);
-    vector_push_back(&sys_alloc_buffer, new_block);
+static free_meta_t *
+new_space(heap_t *heap, size_t size)
+{
+    const size_t requested = size;
+    if (size < TALLOC_BLOCK_SIZE)
+        size = TALLOC_BLOCK_SIZE;
+    // whole pages are owned by talloc so page map never points to foreign memory
+    size = NEXT_MULT_OF(size, TALLOC_PAGE_SIZE);
+
+    if (heap->hard_limit && heap->allocated + size > heap->hard_limit) {
+        // try at least requested size
+        size = NEXT_MULT_OF(requested, TALLOC_PAGE_SIZE);
+        if (heap->allocated + size > heap->hard_limit)
+            return NULL;
+    }
+
+#if TALLOC_HEAP_RESERVE
+    free_meta_t *grown = grow_range(heap, size);
+    if (grown)
+        return grown;
 #endif
+    span_t *span = (span_t *)malloc(sizeof(span_t));
+    free_meta_t *new_block = (free_meta_t *)sys_alloc(size);
+    if (!span || !new_block) {
+        free(span);
+        if (new_block)
+            sys_free(new_block);
+        return NULL;
+    }
+
+    span->begin = (uintptr_t)new_block;
+    span->end = span->begin + size;
+    span->kind = SPAN_HEAP;
+    span->heap = heap;
+    span->next = heap->spans;
+    heap->spans = span;
+    pagemap_set(span->begin, span->end, span);
+    LATENCY_PATH(TALLOC_PATH_GROWTH);
+    PROBE2(new_space, (void *)new_block, size);
 
-    allocated += size;
+    new_block->size = size;
+    new_block->used = false;
+    new_block->quick = false;
+    new_block->purged = false;
+    new_block->huge = false;
+    new_block->epoch = heap->purge_epoch;
+    insert_block_sorted(heap, new_block);
+    heap->allocated += size;
+    if (heap->soft_limit && heap->allocated > heap->soft_limit)
+        tatomic_store(&heap_pressure, true);
+
+    if (heap->wilderness) {
+        if (MOVE_FREE_META_PTR(heap->wilderness, heap->wilderness->size) == new_block) {
+            // system gave us memory right after wilderness -> extend in place
+            remove_block(heap, new_block);
+            heap->wilderness->size += size;
+            return heap->wilderness;
+        }
+        // old tail becomes regular free block
+        heap->free_tree_head = insert_node(heap->free_tree_head, heap->wilderness);
+    }
+    heap->wilderness = new_block;
     return new_block;
 }
 
@@ -410,112 +735,648 @@ can_merge_prev(free_meta_t *block)
 
 // allocate block with proper alignment and save allocation meta data
 static void *
-allocate(free_meta_t *block, size_t size)
+allocate(heap_t *heap, free_meta_t *block, size_t size)
 {
     const size_t rem_space = block->size - size;
-    free_tree_head = remove_node(free_tree_head, block);
+    const bool carve = block == heap->wilderness;
+    if (!carve)
+        heap->free_tree_head = remove_node(heap->free_tree_head, block);
+
     if (rem_space > FREE_META_SIZE) {
         free_meta_t *new_block = MOVE_FREE_META_PTR(block, size);
 
         new_block->size = rem_space;
         new_block->used = false;
-        insert_block(block, block->next, new_block);
-        free_tree_head = insert_node(free_tree_head, new_block);
+        new_block->quick = false;
+        new_block->purged = block->purged;
+        new_block->huge = false;
+        new_block->epoch = block->epoch;
+        insert_block(heap, block, block->next, new_block);
+        if (carve) {
+            heap->wilderness = new_block;
+            heap->stats.carves++;
+        } else {
+            heap->free_tree_head = insert_node(heap->free_tree_head, new_block);
+            heap->stats.splits++;
+        }
     } else {
         size += rem_space;
+        if (carve)
+            heap->wilderness = NULL;
     }
 
+    if (heap->rover == block)
+        heap->rover = block->next;
+
     alloc_meta_t *alloc_block = (alloc_meta_t *)block;
     alloc_block->size = size;
     alloc_block->used = true;
-#if TALLOC_MEM_CHECKING
-    alloc_block->check = (uintptr_t)(alloc_block + 1);
-#endif
+    alloc_block->generation = heap->generation;
     return (alloc_block + 1);
 }
 
-static void
-deallocate(free_meta_t *block)
+// return free block which contains block after merge
+static free_meta_t *
+deallocate(heap_t *heap, free_meta_t *block)
 {
     free_meta_t *new_block = block;
     block->used = false;
 
     free_meta_t *neighbour = can_merge_next(block);
     if (neighbour) {
-        // remove from tree
-        free_tree_head = remove_node(free_tree_head, neighbour);
+        // remove from tree, wilderness is not there and block becomes new one
+        if (neighbour == heap->wilderness)
+            heap->wilderness = block;
+        else
+            heap->free_tree_head = remove_node(heap->free_tree_head, neighbour);
         // remove from list
-        remove_block(neighbour);
+        remove_block(heap, neighbour);
         block->size = block->size + neighbour->size;
+        if (heap->rover == neighbour)
+            heap->rover = block;
+        heap->stats.merges++;
+        PROBE3(coalesce, (void *)block, (void *)neighbour, block->size);
     }
 
     neighbour = can_merge_prev(block);
     if (neighbour) {
         // remove from tree
-        free_tree_head = remove_node(free_tree_head, neighbour);
+        if (neighbour != heap->wilderness)
+            heap->free_tree_head = remove_node(heap->free_tree_head, neighbour);
+        if (block == heap->wilderness)
+            heap->wilderness = neighbour;
         // remove from list
-        remove_block(block);
+        remove_block(heap, block);
         neighbour->size = block->size + neighbour->size;
         new_block = neighbour;
+        if (heap->rover == block)
+            heap->rover = neighbour;
+        heap->stats.merges++;
+        PROBE3(coalesce, (void *)neighbour, (void *)block, neighbour->size);
     }
 
-    free_tree_head = insert_node(free_tree_head, new_block);
+    new_block->purged = false;
+    new_block->epoch = heap->purge_epoch;
+    if (new_block != heap->wilderness)
+        heap->free_tree_head = insert_node(heap->free_tree_head, new_block);
+    return new_block;
 }
 
-void *
-heap_malloc(size_t count)
+#if TALLOC_HEAP_QUICK_BINS
+//*****************************************************************************
+// QUICK LISTS
+//*****************************************************************************
+
+static free_meta_t *
+quick_pop(heap_t *heap, size_t size)
+{
+    quick_bin_t *bin = &heap->quick_bins[SIZE_TO_QUICK_BIN(size)];
+    if (bin->size != size || !bin->head)
+        return NULL;
+
+    free_meta_t *block = bin->head;
+    bin->head = block->left;
+    if (!bin->head)
+        bin->size = 0;
+    block->quick = false;
+    heap->quick_count--;
+    return block;
+}
+
+// park used block in quick list, block stays marked as used so neighbours
+// never merge with it
+static bool
+quick_push(heap_t *heap, free_meta_t *block)
+{
+    quick_bin_t *bin = &heap->quick_bins[SIZE_TO_QUICK_BIN(block->size)];
+    if (bin->head && bin->size != block->size)
+        return false;
+
+    bin->size = block->size;
+    block->left = bin->head;
+    block->quick = true;
+    bin->head = block;
+    heap->quick_count++;
+    return true;
+}
+
+// coalesce all parked blocks
+static void
+quick_flush(heap_t *heap)
+{
+    for (size_t i = 0; i < TALLOC_HEAP_QUICK_BINS; i++) {
+        quick_bin_t *bin = &heap->quick_bins[i];
+        while (bin->head) {
+            free_meta_t *block = bin->head;
+            bin->head = block->left;
+            block->quick = false;
+            deallocate(heap, block);
+        }
+        bin->size = 0;
+    }
+    heap->quick_count = 0;
+}
+//*****************************************************************************
+#endif
+
+#if TALLOC_HUGE_SIZE
+//*****************************************************************************
+// HUGE CHUNKS
+//*****************************************************************************
+// huge chunk is span of its own with allocation header at begin, size in header
+// is whole mapped length
+
+static void *
+sys_map(size_t size)
+{
+#ifdef _WIN32
+    return VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    // mapping is aligned to system page only, cut ends when talloc page is bigger
+    const size_t extra = TALLOC_PAGE_SIZE > 4096 ? TALLOC_PAGE_SIZE : 0;
+    byte_t *mem = (byte_t *)mmap(NULL, size + extra, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == (byte_t *)MAP_FAILED)
+        return NULL;
+    if (extra) {
+        byte_t *aligned = (byte_t *)NEXT_MULT_OF((uintptr_t)mem, TALLOC_PAGE_SIZE);
+        if (aligned > mem)
+            munmap(mem, aligned - mem);
+        munmap(aligned + size, mem + extra - aligned);
+        mem = aligned;
+    }
+    return mem;
+#endif
+}
+
+static void
+sys_unmap(void *mem, size_t size)
+{
+#ifdef _WIN32
+    (void)size;
+    VirtualFree(mem, 0, MEM_RELEASE);
+#else
+    munmap(mem, size);
+#endif
+}
+
+static span_t *
+map_chunk(heap_t *heap, size_t size);
+static void
+unmap_chunk(heap_t *heap, span_t *span);
+
+#if TALLOC_HUGE_CACHE_SIZE
+// shrink mapping in place to size bytes
+static bool
+sys_trim(void *mem, size_t old_size, size_t size)
+{
+#if defined(__linux__)
+    return mremap(mem, old_size, size, 0) != MAP_FAILED;
+#elif defined(_WIN32)
+    (void)mem, (void)old_size, (void)size;
+    return false;
+#else
+    return !munmap((byte_t *)mem + size, old_size - size);
+#endif
+}
+
+static uint64_t
+now_ms(void)
+{
+#ifdef _WIN32
+    return GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+#endif
+}
+
+static size_t
+huge_bin(size_t size)
+{
+    size_t bin = 0;
+    for (size_t s = size / TALLOC_HUGE_SIZE; s > 1 && bin < HUGE_BINS - 1; s >>= 1)
+        bin++;
+    return bin;
+}
+
+static void
+cache_remove(heap_t *heap, huge_cached_t **link)
+{
+    huge_cached_t *cached = *link;
+    *link = cached->next;
+    heap->huge_cached -= cached->span->end - cached->span->begin;
+    unmap_chunk(heap, cached->span);
+}
+
+// unmap chunks cached for at least age milliseconds
+static void
+cache_expire(heap_t *heap, uint64_t age)
+{
+    if (!heap->huge_cached)
+        return;
+    const uint64_t now = now_ms();
+    for (size_t i = 0; i < HUGE_BINS; i++) {
+        huge_cached_t **link = &heap->huge_bins[i];
+        while (*link) {
+            if (now - (*link)->freed >= age)
+                cache_remove(heap, link);
+            else
+                link = &(*link)->next;
+        }
+    }
+}
+
+static void
+cache_evict_oldest(heap_t *heap)
+{
+    huge_cached_t **oldest = NULL;
+    for (size_t i = 0; i < HUGE_BINS; i++) {
+        for (huge_cached_t **link = &heap->huge_bins[i]; *link; link = &(*link)->next) {
+            if (!oldest || (*link)->freed < (*oldest)->freed)
+                oldest = link;
+        }
+    }
+    cache_remove(heap, oldest);
+}
+
+// take smallest cached chunk of at least size bytes from bin of size or the
+// next one, large excess is trimmed off
+static span_t *
+cache_take(heap_t *heap, size_t size)
+{
+    huge_cached_t **best = NULL;
+    const size_t bin = huge_bin(size);
+    for (size_t i = bin; i < HUGE_BINS && i <= bin + 1 && !best; i++) {
+        for (huge_cached_t **link = &heap->huge_bins[i]; *link; link = &(*link)->next) {
+            const span_t *span = (*link)->span;
+            const size_t chunk = span->end - span->begin;
+            if (chunk >= size && (!best || chunk < (*best)->span->end - (*best)->span->begin))
+                best = link;
+        }
+    }
+    if (!best)
+        return NULL;
+
+    span_t *span = (*best)->span;
+    *best = (*best)->next;
+    const size_t chunk = span->end - span->begin;
+    heap->huge_cached -= chunk;
+    if (chunk - size > size / 4 && sys_trim((void *)span->begin, chunk, size)) {
+        pagemap_set(span->begin + size, span->end, NULL);
+        span->end = span->begin + size;
+        heap->allocated -= chunk - size;
+        heap->stats.released_bytes += chunk - size;
+    }
+    heap->stats.huge_cache_hits++;
+    return span;
+}
+
+static void
+cache_put(heap_t *heap, span_t *span)
+{
+    const size_t size = span->end - span->begin;
+    // no caching under memory pressure
+    if (size > TALLOC_HUGE_CACHE_SIZE || (heap->soft_limit && heap->allocated > heap->soft_limit)) {
+        unmap_chunk(heap, span);
+        return;
+    }
+    while (heap->huge_cached + size > TALLOC_HUGE_CACHE_SIZE)
+        cache_evict_oldest(heap);
+
+    huge_cached_t *cached = (huge_cached_t *)(span->begin + ALLOC_META_SIZE);
+    const size_t bin = huge_bin(size);
+    cached->span = span;
+    cached->freed = now_ms();
+    cached->next = heap->huge_bins[bin];
+    heap->huge_bins[bin] = cached;
+    heap->huge_cached += size;
+}
+#endif
+
+static span_t *
+map_chunk(heap_t *heap, size_t size)
+{
+    if (heap->hard_limit) {
+#if TALLOC_HUGE_CACHE_SIZE
+        while (heap->huge_cached && heap->allocated + size > heap->hard_limit)
+            cache_evict_oldest(heap);
+#endif
+        if (heap->allocated + size > heap->hard_limit)
+            return NULL;
+    }
+
+    span_t *span = (span_t *)malloc(sizeof(span_t));
+    void *mem = sys_map(size);
+    if (!span || !mem) {
+        free(span);
+        if (mem)
+            sys_unmap(mem, size);
+        return NULL;
+    }
+
+    span->begin = (uintptr_t)mem;
+    span->end = span->begin + size;
+    span->kind = SPAN_HUGE;
+    span->heap = heap;
+    span->next = heap->huge_spans;
+    heap->huge_spans = span;
+    heap->huge_count++;
+    pagemap_set(span->begin, span->end, span);
+    LATENCY_PATH(TALLOC_PATH_GROWTH);
+    PROBE2(new_space, mem, size);
+
+    heap->allocated += size;
+    if (heap->soft_limit && heap->allocated > heap->soft_limit)
+        tatomic_store(&heap_pressure, true);
+    return span;
+}
+
+static void
+unmap_chunk(heap_t *heap, span_t *span)
+{
+    span_t **link = &heap->huge_spans;
+    while (*link != span)
+        link = &(*link)->next;
+    *link = span->next;
+    heap->huge_count--;
+
+    const size_t size = span->end - span->begin;
+    pagemap_set(span->begin, span->end, NULL);
+    sys_unmap((void *)span->begin, size);
+    free(span);
+    heap->allocated -= size;
+    heap->stats.released_bytes += size;
+}
+
+static void *
+huge_malloc(heap_t *heap, size_t count)
+{
+    if (count > SIZE_MAX - ALLOC_META_SIZE - TALLOC_PAGE_SIZE)
+        return NULL;
+    const size_t size = NEXT_MULT_OF(count + ALLOC_META_SIZE, TALLOC_PAGE_SIZE);
+
+    LOCK(heap->flag);
+    heap->stats.allocations++;
+    heap->stats.huge_allocations++;
+#if TALLOC_HUGE_CACHE_SIZE
+    cache_expire(heap, TALLOC_HUGE_CACHE_AGE);
+    span_t *span = cache_take(heap, size);
+    if (!span)
+        span = map_chunk(heap, size);
+#else
+    span_t *span = map_chunk(heap, size);
+#endif
+    if (!span) {
+        UNLOCK(heap->flag);
+        return NULL;
+    }
+
+    alloc_meta_t *block = (alloc_meta_t *)span->begin;
+    block->next = NULL;
+    block->prev = NULL;
+    block->used = true;
+    block->quick = false;
+    block->purged = false;
+    block->huge = true;
+    block->generation = heap->generation;
+    block->size = span->end - span->begin;
+    heap->used += block->size;
+    UNLOCK(heap->flag);
+    PROBE2(large_alloc, block + 1, block->size);
+    return block + 1;
+}
+
+// used bytes are already subtracted
+static void
+huge_free(heap_t *heap, alloc_meta_t *block)
+{
+    block->used = false;
+#if TALLOC_HUGE_CACHE_SIZE
+    cache_put(heap, pagemap_get(block));
+    cache_expire(heap, TALLOC_HUGE_CACHE_AGE);
+#else
+    unmap_chunk(heap, pagemap_get(block));
+#endif
+}
+//*****************************************************************************
+#endif
+
+size_t
+heap_block_size(size_t count)
 {
     count = count + ALLOC_META_SIZE;
     if (count < FREE_META_SIZE)
         count = FREE_META_SIZE;
     ADJUST_SIZE(count);
+    return count;
+}
+
+void *
+heap_malloc(heap_t *heap, size_t count)
+{
+#if TALLOC_HUGE_SIZE
+    if (count >= TALLOC_HUGE_SIZE)
+        return huge_malloc(heap, count);
+#endif
+    count = heap_block_size(count);
+
+    free_meta_t *block = NULL;
+    LOCK(heap->flag);
+    heap->stats.allocations++;
+#if TALLOC_HEAP_QUICK_BINS
+    block = quick_pop(heap, count);
+    if (block) {
+        heap->stats.quick_hits++;
+        heap->used += block->size;
+        block->generation = heap->generation;
+        UNLOCK(heap->flag);
+        return (alloc_meta_t *)block + 1;
+    }
+#endif
 
-    LOCK(heap_flag);
-    free_meta_t *block = find_free_node(free_tree_head, count);
+    block = find_block(heap, count);
+#if TALLOC_HEAP_QUICK_BINS
+    if (!block && heap->quick_count) {
+        // parked blocks can merge into block big enough
+        quick_flush(heap);
+        block = find_block(heap, count);
+    }
+#endif
     if (!block) {
-        // no free block with requested size -> allocate new one
-        block = new_space(count);
+        // carve from wilderness, allocate new one when it's too small
+        if ((!heap->wilderness || heap->wilderness->size < count) && !new_space(heap, count)) {
+            UNLOCK(heap->flag);
+            return NULL;
+        }
+        block = heap->wilderness;
     }
 
     ASSERT(block->size >= count, "not enough space");
-    void *ret = allocate(block, count);
-    used += count;
-    UNLOCK(heap_flag);
+    void *ret = allocate(heap, block, count);
+    heap->used += block->size;
+    UNLOCK(heap->flag);
+    if (count >= TALLOC_USDT_LARGE_SIZE) {
+        PROBE2(large_alloc, ret, count);
+    }
+
+    return ret;
+}
+
+// split free block at lead bytes and return its second part, first part
+// stays free
+static free_meta_t *
+split_front(heap_t *heap, free_meta_t *block, size_t lead)
+{
+    free_meta_t *aligned = MOVE_FREE_META_PTR(block, lead);
+    aligned->size = block->size - lead;
+    aligned->used = false;
+    aligned->quick = false;
+    aligned->purged = block->purged;
+    aligned->huge = false;
+    aligned->epoch = block->epoch;
+    insert_block(heap, block, block->next, aligned);
+
+    if (block == heap->wilderness)
+        heap->wilderness = aligned;
+    else {
+        // size of block changes, second part goes into tree to be taken by
+        // allocate
+        heap->free_tree_head = remove_node(heap->free_tree_head, block);
+        heap->free_tree_head = insert_node(heap->free_tree_head, aligned);
+    }
+    block->size = lead;
+    heap->free_tree_head = insert_node(heap->free_tree_head, block);
+    heap->stats.splits++;
+    return aligned;
+}
+
+void *
+heap_malloc_aligned(heap_t *heap, size_t count, size_t alignment)
+{
+    ASSERT(alignment && !(alignment & (alignment - 1)), "alignment must be power of two");
+    count = heap_block_size(count);
+    // aligned block can start up to alignment bytes further and space before it
+    // must fit free block
+    const size_t search = count + alignment + FREE_META_SIZE;
+
+    LOCK(heap->flag);
+    heap->stats.allocations++;
+    // quick lists are not searched, they hold blocks of exact size only
+    free_meta_t *block = find_block(heap, search);
+#if TALLOC_HEAP_QUICK_BINS
+    if (!block && heap->quick_count) {
+        quick_flush(heap);
+        block = find_block(heap, search);
+    }
+#endif
+    if (!block) {
+        if ((!heap->wilderness || heap->wilderness->size < search) && !new_space(heap, search)) {
+            UNLOCK(heap->flag);
+            return NULL;
+        }
+        block = heap->wilderness;
+    }
 
+    uintptr_t payload = NEXT_MULT_OF((uintptr_t)block + ALLOC_META_SIZE, alignment);
+    size_t lead = payload - ALLOC_META_SIZE - (uintptr_t)block;
+    if (lead && lead < FREE_META_SIZE)
+        lead += alignment;
+    if (lead)
+        block = split_front(heap, block, lead);
+
+    ASSERT(block->size >= count, "not enough space");
+    void *ret = allocate(heap, block, count);
+    heap->used += block->size;
+    UNLOCK(heap->flag);
     return ret;
 }
 
 void
-heap_free(void *ptr)
+heap_free(heap_t *heap, void *ptr)
 {
     if (!ptr)
         return;
     free_meta_t *block = (free_meta_t *)GET_ALLOC_META_PTR(ptr);
 
-    LOCK(heap_flag);
-    used -= block->size;
-    deallocate(block);
-    UNLOCK(heap_flag);
+#if TALLOC_MEM_CHECKING
+    if (!block->used || block->quick) {
+        ABORT("pointer being freed was not allocated");
+    }
+#endif
+
+    LOCK(heap->flag);
+    heap->stats.frees++;
+    heap->used -= block->size;
+#if TALLOC_HUGE_SIZE
+    if (block->huge) {
+        huge_free(heap, (alloc_meta_t *)block);
+        UNLOCK(heap->flag);
+        return;
+    }
+#endif
+#if TALLOC_HEAP_QUICK_BINS
+    if (heap->quick_count >= TALLOC_HEAP_QUICK_MAX)
+        quick_flush(heap);
+    if (quick_push(heap, block)) {
+        UNLOCK(heap->flag);
+        return;
+    }
+#endif
+    deallocate(heap, block);
+    UNLOCK(heap->flag);
+}
+
+size_t
+heap_usable_size(const void *ptr)
+{
+    const alloc_meta_t *block = GET_ALLOC_META_PTR(ptr);
+    return (block->size & ~SAMPLED_FLAG) - ALLOC_META_SIZE;
 }
 
 void
-heap_expand(size_t count)
+heap_expand(heap_t *heap, size_t count)
 {
     if (count < TALLOC_BLOCK_SIZE)
         count = TALLOC_BLOCK_SIZE;
 
-    new_space(count);
+    LOCK(heap->flag);
+    new_space(heap, count);
+    UNLOCK(heap->flag);
+}
+
+bool
+heap_reserve(heap_t *heap, size_t bytes)
+{
+    LOCK(heap->flag);
+    if ((!heap->wilderness || heap->wilderness->size < bytes) && !new_space(heap, bytes)) {
+        UNLOCK(heap->flag);
+        return false;
+    }
+
+    // touch every page of reserved part of wilderness, header page is in use
+    free_meta_t *block = heap->wilderness;
+    const uintptr_t begin = (uintptr_t)block + FREE_META_SIZE;
+    const uintptr_t end = (uintptr_t)block + (bytes < block->size ? bytes : block->size);
+    for (uintptr_t page = NEXT_MULT_OF(begin, TALLOC_PAGE_SIZE); page < end;
+         page += TALLOC_PAGE_SIZE)
+        *(volatile byte_t *)page = 0;
+    block->purged = false;
+    heap->reserved = true;
+    UNLOCK(heap->flag);
+    return true;
 }
 
 void
-heap_print_blocks(FILE *file)
+heap_print_blocks(heap_t *heap, FILE *file)
 {
     fprintf(file, "\n");
     fprintf(file, "┏━━━━━━━━━━━━━━━━━━┯━━━━━━━━━━┯━━━━━━━━━━━━━━━━━━┯━━━━━━━━━━━━━━━━━━┓\n");
     fprintf(file, "┃ address          │   size   │ previous         │ next             ┃\n");
     fprintf(file, "┠──────────────────┼──────────┼──────────────────┼──────────────────┨\n");
-    free_meta_t *current = &list_head;
-    LOCK(heap_flag);
+    free_meta_t *current = &heap->list_head;
+    LOCK(heap->flag);
     while (current) {
         if (!current->used)
             fprintf(file, "┃ %16p │ %8zu │ %16p │ %16p ┃\n", current, current->size, current->prev,
@@ -524,36 +1385,366 @@ heap_print_blocks(FILE *file)
             break;
         current = current->next;
     }
-    UNLOCK(heap_flag);
+    UNLOCK(heap->flag);
     fprintf(file, "┗━━━━━━━━━━━━━━━━━━┷━━━━━━━━━━┷━━━━━━━━━━━━━━━━━━┷━━━━━━━━━━━━━━━━━━┛\n\n");
 
     //    print_tree(file, free_tree_head);
 }
 
 size_t
-heap_allocated(void)
+heap_copy_blocks(heap_t *heap, talloc_block_info_t *blocks, size_t capacity)
+{
+    LOCK(heap->flag);
+    size_t count = heap->block_count;
+#if TALLOC_HUGE_SIZE
+    count += heap->huge_count;
+#endif
+    if (count <= capacity) {
+        talloc_block_info_t *info = blocks;
+        for (free_meta_t *current = heap->list_head.next; current; current = current->next, info++) {
+            info->address = (uintptr_t)current;
+            info->size = current->size & ~SAMPLED_FLAG;
+            info->used = current->used && !current->quick;
+        }
+#if TALLOC_HUGE_SIZE
+        for (span_t *span = heap->huge_spans; span; span = span->next, info++) {
+            info->address = span->begin;
+            info->size = span->end - span->begin;
+            info->used = ((alloc_meta_t *)span->begin)->used;
+        }
+#endif
+    }
+    UNLOCK(heap->flag);
+    return count;
+}
+
+// take free block out of heap
+static void
+drop_block(heap_t *heap, free_meta_t *block)
+{
+    if (block == heap->wilderness)
+        heap->wilderness = NULL;
+    else
+        heap->free_tree_head = remove_node(heap->free_tree_head, block);
+    if (heap->rover == block)
+        heap->rover = block->next;
+    remove_block(heap, block);
+}
+
+// return span covered by single free block to system
+static void
+release_span(heap_t *heap, free_meta_t *block, span_t *span)
+{
+    drop_block(heap, block);
+
+    span_t **link = &heap->spans;
+    while (*link != span)
+        link = &(*link)->next;
+    *link = span->next;
+
+    const size_t size = span->end - span->begin;
+    pagemap_set(span->begin, span->end, NULL);
+    sys_free((void *)span->begin);
+    free(span);
+    heap->allocated -= size;
+    heap->stats.released_bytes += size;
+}
+
+#if TALLOC_HEAP_RESERVE
+// decommit free block at end of range, its header page stays unless block
+// starts the range
+static void
+shrink_range(heap_t *heap, free_meta_t *block)
+{
+    span_t *range = &heap->range;
+    const uintptr_t begin = (uintptr_t)block;
+    const uintptr_t cut =
+        begin == range->begin ? begin : NEXT_MULT_OF(begin + FREE_META_SIZE, TALLOC_PAGE_SIZE);
+    if (cut < range->end) {
+        if (cut == begin)
+            drop_block(heap, block);
+        else if (block == heap->wilderness)
+            block->size = cut - begin;
+        else {
+            heap->free_tree_head = remove_node(heap->free_tree_head, block);
+            block->size = cut - begin;
+            heap->free_tree_head = insert_node(heap->free_tree_head, block);
+        }
+
+        const size_t size = range->end - cut;
+        pagemap_set(cut, range->end, NULL);
+        sys_decommit((void *)cut, size);
+        range->end = cut;
+        heap->allocated -= size;
+        heap->stats.released_bytes += size;
+        if (cut == begin)
+            return;
+    }
+    block->purged = true;
+}
+#endif
+
+// release or purge free block which stayed free for at least decay epochs
+static void
+purge_block(heap_t *heap, free_meta_t *block, unsigned decay)
+{
+    if (block->used || block->purged || heap->purge_epoch - block->epoch < decay)
+        return;
+    if (block == heap->wilderness && heap->reserved)
+        return;
+
+    span_t *span = pagemap_get(block);
+    const uintptr_t begin = (uintptr_t)block;
+#if TALLOC_HEAP_RESERVE
+    if (span == &heap->range && begin + block->size == span->end) {
+        shrink_range(heap, block);
+        return;
+    }
+#endif
+    if (span->begin == begin && span->end == begin + block->size) {
+        release_span(heap, block, span);
+        return;
+    }
+
+    // keep block header, purge whole pages behind it
+    const uintptr_t first = NEXT_MULT_OF(begin + FREE_META_SIZE, TALLOC_PAGE_SIZE);
+    const uintptr_t last = (begin + block->size) & ~(uintptr_t)(TALLOC_PAGE_SIZE - 1);
+    if (last > first) {
+        sys_purge((void *)first, last - first);
+        heap->stats.purged_bytes += last - first;
+    }
+    block->purged = true;
+}
+
+void
+heap_purge(heap_t *heap)
+{
+    LOCK(heap->flag);
+    heap->reserved = false;
+#if TALLOC_HEAP_QUICK_BINS
+    quick_flush(heap);
+#endif
+    free_meta_t *current = heap->list_head.next;
+    while (current) {
+        free_meta_t *next = current->next;
+        purge_block(heap, current, 0);
+        current = next;
+    }
+#if TALLOC_HUGE_SIZE && TALLOC_HUGE_CACHE_SIZE
+    cache_expire(heap, 0);
+#endif
+    UNLOCK(heap->flag);
+}
+
+bool
+heap_purge_step(heap_t *heap, unsigned decay, size_t budget)
+{
+    if (!TRY_LOCK(heap->flag))
+        return false;
+
+    heap->purge_epoch++;
+    free_meta_t *current = heap->purge_cursor ? heap->purge_cursor : heap->list_head.next;
+    for (size_t i = 0; current && i < budget; i++) {
+        free_meta_t *next = current->next;
+        purge_block(heap, current, decay);
+        current = next;
+    }
+    heap->purge_cursor = current;
+#if TALLOC_HUGE_SIZE && TALLOC_HUGE_CACHE_SIZE
+    cache_expire(heap, TALLOC_HUGE_CACHE_AGE);
+#endif
+    UNLOCK(heap->flag);
+    return true;
+}
+
+bool
+heap_usage(heap_t *heap, size_t *out_allocated, size_t *out_used, size_t *out_largest_free)
+{
+    if (!TRY_LOCK(heap->flag))
+        return false;
+    size_t largest = heap->wilderness ? heap->wilderness->size : 0;
+    free_meta_t *node = heap->free_tree_head;
+    while (node && node->right)
+        node = node->right;
+    if (node && node->size > largest)
+        largest = node->size;
+    *out_allocated = heap->allocated;
+    *out_used = heap->used;
+    *out_largest_free = largest;
+    UNLOCK(heap->flag);
+    return true;
+}
+
+void
+heap_set_limits(heap_t *heap, size_t soft, size_t hard)
+{
+    LOCK(heap->flag);
+    heap->soft_limit = soft;
+    heap->hard_limit = hard;
+    UNLOCK(heap->flag);
+}
+
+size_t
+heap_soft_limit(heap_t *heap)
 {
-    return allocated;
+    return heap->soft_limit;
 }
 
 size_t
-heap_used(void)
+heap_hard_limit(heap_t *heap)
 {
-    return used;
+    return heap->hard_limit;
+}
+
+void
+heap_set_policy(heap_t *heap, talloc_policy_t new_policy)
+{
+    LOCK(heap->flag);
+    heap->policy = new_policy;
+    heap->rover = NULL;
+    UNLOCK(heap->flag);
+}
+
+void
+heap_get_stats(heap_t *heap, talloc_heap_stats_t *out)
+{
+    LOCK(heap->flag);
+    *out = heap->stats;
+    out->policy = heap->policy;
+    UNLOCK(heap->flag);
+}
+
+void
+heap_reset_stats(heap_t *heap)
+{
+    LOCK(heap->flag);
+    heap->stats = (const talloc_heap_stats_t){0};
+    UNLOCK(heap->flag);
+}
+
+size_t
+heap_allocated(heap_t *heap)
+{
+    return heap->allocated;
+}
+
+size_t
+heap_used(heap_t *heap)
+{
+    return heap->used;
+}
+
+// return all system memory of heap
+static void
+release_spans(heap_t *heap)
+{
+    while (heap->spans) {
+        span_t *span = heap->spans;
+        heap->spans = span->next;
+        pagemap_set(span->begin, span->end, NULL);
+        sys_free((void *)span->begin);
+        free(span);
+    }
+#if TALLOC_HEAP_RESERVE
+    if (heap->range_base) {
+        pagemap_set(heap->range.begin, heap->range.end, NULL);
+        sys_release(heap->range_base, RANGE_SIZE + TALLOC_PAGE_SIZE);
+        heap->range_base = NULL;
+        heap->range = (const span_t){0};
+    }
+#endif
+#if TALLOC_HUGE_SIZE
+    while (heap->huge_spans) {
+        span_t *span = heap->huge_spans;
+        heap->huge_spans = span->next;
+        pagemap_set(span->begin, span->end, NULL);
+        sys_unmap((void *)span->begin, span->end - span->begin);
+        free(span);
+    }
+    heap->huge_count = 0;
+#if TALLOC_HUGE_CACHE_SIZE
+    for (size_t i = 0; i < HUGE_BINS; i++)
+        heap->huge_bins[i] = NULL;
+    heap->huge_cached = 0;
+#endif
+#endif
+}
+
+heap_t *
+heap_create(void)
+{
+    heap_t *heap = (heap_t *)calloc(1, sizeof(heap_t));
+    if (heap)
+        heap->policy = TALLOC_HEAP_POLICY;
+    return heap;
+}
+
+void
+heap_destroy(heap_t *heap)
+{
+    ASSERT(heap != &global_heap, "global heap cannot be destroyed");
+    release_spans(heap);
+    free(heap);
+}
+
+unsigned
+heap_mark(heap_t *heap)
+{
+    LOCK(heap->flag);
+    const unsigned generation = ++heap->generation;
+    UNLOCK(heap->flag);
+    return generation;
 }
 
-#if TALLOC_FORCE_RESET
 void
-heap_force_reset(void)
+heap_rewind(heap_t *heap, unsigned generation)
 {
-    for (size_t i = 0; i < sys_alloc_buffer.size; i++) {
-        free(vector_at(&sys_alloc_buffer, i));
+    LOCK(heap->flag);
+#if TALLOC_HEAP_QUICK_BINS
+    quick_flush(heap);
+#endif
+    free_meta_t *current = heap->list_head.next;
+    while (current) {
+        if (current->used && current->generation >= generation) {
+            heap->used -= current->size;
+            current = deallocate(heap, current);
+        }
+        current = current->next;
+    }
+#if TALLOC_HUGE_SIZE
+    // caching freed chunk can unmap others, restart from head
+    span_t *span = heap->huge_spans;
+    while (span) {
+        alloc_meta_t *block = (alloc_meta_t *)span->begin;
+        if (block->used && block->generation >= generation) {
+            heap->used -= block->size;
+            huge_free(heap, block);
+            span = heap->huge_spans;
+        } else
+            span = span->next;
     }
-    vector_free(&sys_alloc_buffer);
+#endif
+    heap->generation = generation - 1;
+    UNLOCK(heap->flag);
+}
 
-    list_head = (const free_meta_t){0};
-    free_tree_head = NULL;
-    allocated = 0;
-    used = 0;
+#if TALLOC_FORCE_RESET
+void
+heap_force_reset(heap_t *heap)
+{
+    release_spans(heap);
+    heap->list_head = (const free_meta_t){0};
+    heap->free_tree_head = NULL;
+    heap->rover = NULL;
+    heap->wilderness = NULL;
+    heap->purge_cursor = NULL;
+    heap->block_count = 0;
+#if TALLOC_HEAP_QUICK_BINS
+    for (size_t i = 0; i < TALLOC_HEAP_QUICK_BINS; i++)
+        heap->quick_bins[i] = (const quick_bin_t){0};
+    heap->quick_count = 0;
+#endif
+    heap->allocated = 0;
+    heap->used = 0;
 }
 #endif
@@ -31,26 +31,138 @@
 
 #include <stdio.h>
 #include <stddef.h>
+#include <stdbool.h>
+#include "talloc/talloc.h"
+#include "tatomic.h"
 
+typedef struct heap heap_t;
+
+// default instance used by global allocator API
+extern heap_t global_heap;
+
+// set when system memory obtained by heap crossed soft limit
+extern tatomic_bool heap_pressure;
+
+/**
+ * Create independent heap instance with its own system memory.
+ * @return New heap or NULL when out of memory.
+ */
+heap_t *
+heap_create(void);
+
+/**
+ * Destroy heap instance and return all its memory to system.
+ */
+void
+heap_destroy(heap_t *heap);
+
+void *
+heap_malloc(heap_t *heap, size_t count);
+
+/**
+ * Allocate count bytes at address aligned to alignment, which must be power of
+ * two. Space skipped before aligned block stays free.
+ * @return Memory or NULL when out of memory.
+ */
 void *
-heap_malloc(size_t count);
+heap_malloc_aligned(heap_t *heap, size_t count, size_t alignment);
+
+void
+heap_free(heap_t *heap, void *ptr);
+
+size_t
+heap_usable_size(const void *ptr);
+
+void
+heap_expand(heap_t *heap, size_t size);
+
+/**
+ * Size of heap block serving allocation of count bytes.
+ */
+size_t
+heap_block_size(size_t count);
+
+/**
+ * Make sure wilderness has at least bytes and prefault its pages, blocks of
+ * that total size are then allocated without growing heap.
+ * @return False when heap cannot grow.
+ */
+bool
+heap_reserve(heap_t *heap, size_t bytes);
+
+size_t
+heap_allocated(heap_t *heap);
+
+size_t
+heap_used(heap_t *heap);
 
 void
-heap_free(void *ptr);
+heap_print_blocks(heap_t *heap, FILE *file);
 
+/**
+ * Release system blocks which are completely free and give pages of other free
+ * blocks back to system.
+ */
 void
-heap_expand(size_t size);
+heap_purge(heap_t *heap);
+
+/**
+ * Continue incremental purge over at most budget blocks, only blocks free for
+ * at least decay steps are purged.
+ * @return False when heap was locked and nothing was done.
+ */
+bool
+heap_purge_step(heap_t *heap, unsigned decay, size_t budget);
+
+/**
+ * Consistent state of heap, largest free block is found in tree and wilderness
+ * only (parked blocks are not counted). Heap lock is only tried.
+ * @return False when heap was locked and nothing was written.
+ */
+bool
+heap_usage(heap_t *heap, size_t *allocated, size_t *used, size_t *largest_free);
+
+void
+heap_set_limits(heap_t *heap, size_t soft, size_t hard);
 
 size_t
-heap_allocated();
+heap_soft_limit(heap_t *heap);
 
 size_t
-heap_used(void);
+heap_hard_limit(heap_t *heap);
+
+void
+heap_set_policy(heap_t *heap, talloc_policy_t policy);
+
+void
+heap_get_stats(heap_t *heap, talloc_heap_stats_t *stats);
+
+void
+heap_reset_stats(heap_t *heap);
+
+/**
+ * Copy description of all heap blocks in address order into blocks when
+ * capacity is big enough.
+ * @return Count of heap blocks.
+ */
+size_t
+heap_copy_blocks(heap_t *heap, talloc_block_info_t *blocks, size_t capacity);
+
+/**
+ * Start new generation of heap, blocks allocated from now on are stamped with
+ * returned generation.
+ */
+unsigned
+heap_mark(heap_t *heap);
 
+/**
+ * Free all blocks allocated in generation or later ones, system memory stays
+ * mapped.
+ */
 void
-heap_print_blocks(FILE *file);
+heap_rewind(heap_t *heap, unsigned generation);
 
 void
-heap_force_reset(void);
+heap_force_reset(heap_t *heap);
 
 #endif /* end of include guard: HEAP_H_SRLF2NOC */
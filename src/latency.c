@@ -0,0 +1,247 @@
+//*****************************************************************************
+// talloc
+//
+// File:   latency.c
+// Author: Martin Dorazil
+// Date:   19/10/2026
+//
+// Copyright 2017 Martin Dorazil
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+
+#include <string.h>
+#include "latency.h"
+#include "tatomic.h"
+#include "utils.h"
+#if TALLOC_LATENCY_STATS
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+#endif
+
+// values below SUB_COUNT have own bucket, every higher power of two is split
+// into SUB_COUNT buckets
+#define SUB_BITS 3
+#define SUB_COUNT (1u << SUB_BITS)
+#define MAX_EXPONENT ((TALLOC_LATENCY_BUCKETS - SUB_COUNT) / SUB_COUNT + SUB_BITS - 1)
+
+#if TALLOC_LATENCY_STATS
+static size_t
+bucket_index(uint64_t value)
+{
+    if (value < SUB_COUNT)
+        return (size_t)value;
+    unsigned exponent = 0;
+    for (uint64_t v = value; v >>= 1;)
+        exponent++;
+    if (exponent > MAX_EXPONENT)
+        return TALLOC_LATENCY_BUCKETS - 1;
+    const size_t sub = (size_t)(value >> (exponent - SUB_BITS)) & (SUB_COUNT - 1);
+    return SUB_COUNT + (exponent - SUB_BITS) * SUB_COUNT + sub;
+}
+#endif
+
+uint64_t
+talloc_latency_bucket_value(size_t bucket)
+{
+    if (bucket < SUB_COUNT)
+        return bucket;
+    const unsigned exponent = (unsigned)((bucket - SUB_COUNT) / SUB_COUNT) + SUB_BITS;
+    const uint64_t sub = (bucket - SUB_COUNT) % SUB_COUNT;
+    return (SUB_COUNT + sub) << (exponent - SUB_BITS);
+}
+
+uint64_t
+talloc_latency_percentile(const talloc_latency_histogram_t *histogram, double percentile)
+{
+    if (!histogram->count)
+        return 0;
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)histogram->count + 0.5);
+    if (rank < 1)
+        rank = 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < TALLOC_LATENCY_BUCKETS - 1; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            const uint64_t bound = talloc_latency_bucket_value(i + 1) - 1;
+            return bound < histogram->max ? bound : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+#if TALLOC_LATENCY_STATS
+// histogram written only by owner thread, read by merge without lock
+typedef struct latency_histogram {
+    tatomic_u64 count;
+    tatomic_u64 total;
+    tatomic_u64 min;
+    tatomic_u64 max;
+    tatomic_u64 buckets[TALLOC_LATENCY_BUCKETS];
+} latency_histogram_t;
+
+// histograms of one thread, record of exited thread is adopted by new one
+typedef struct latency_record {
+    struct latency_record *next;
+    tatomic_bool owned;
+    latency_histogram_t histograms[TALLOC_LATENCY_OP_COUNT][TALLOC_PATH_COUNT];
+} latency_record_t;
+
+THREAD_LOCAL unsigned latency_path;
+static THREAD_LOCAL latency_record_t *thread_record;
+static latency_record_t *records;
+static tatomic_bool records_flag;
+#ifdef _WIN32
+static DWORD record_key = FLS_OUT_OF_INDEXES;
+static INIT_ONCE key_once = INIT_ONCE_STATIC_INIT;
+#else
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t record_key;
+#endif
+
+#define INCREMENT(obj, val) tatomic_store_relaxed((obj), tatomic_load_relaxed(obj) + (val))
+
+#ifdef _WIN32
+static void WINAPI
+release_record(void *data)
+#else
+static void
+release_record(void *data)
+#endif
+{
+    latency_record_t *record = (latency_record_t *)data;
+    tatomic_store(&record->owned, false);
+    thread_record = NULL;
+}
+
+#ifdef _WIN32
+static BOOL CALLBACK
+create_key(PINIT_ONCE once, void *param, void **ctx)
+{
+    (void)once, (void)param, (void)ctx;
+    record_key = FlsAlloc(release_record);
+    return TRUE;
+}
+#else
+static void
+create_key(void)
+{
+    pthread_key_create(&record_key, release_record);
+}
+#endif
+
+static latency_record_t *
+acquire_record(void)
+{
+    latency_record_t *record = NULL;
+    LOCK(records_flag);
+    for (record = records; record; record = record->next) {
+        if (!tatomic_load(&record->owned))
+            break;
+    }
+    if (!record) {
+        record = (latency_record_t *)calloc(1, sizeof(latency_record_t));
+        if (!record) {
+            UNLOCK(records_flag);
+            return NULL;
+        }
+        record->next = records;
+        records = record;
+    }
+    tatomic_store(&record->owned, true);
+    UNLOCK(records_flag);
+
+    // record is released when thread exits
+#ifdef _WIN32
+    InitOnceExecuteOnce(&key_once, create_key, NULL, NULL);
+    FlsSetValue(record_key, record);
+#else
+    pthread_once(&key_once, create_key);
+    pthread_setspecific(record_key, record);
+#endif
+    return record;
+}
+
+void
+latency_end(talloc_latency_op_t op, uint64_t start)
+{
+    const uint64_t ticks = latency_now() - start;
+    if (!thread_record && !(thread_record = acquire_record()))
+        return;
+    latency_histogram_t *histogram = &thread_record->histograms[op][latency_path];
+    if (!tatomic_load_relaxed(&histogram->count) || ticks < tatomic_load_relaxed(&histogram->min))
+        tatomic_store_relaxed(&histogram->min, ticks);
+    if (ticks > tatomic_load_relaxed(&histogram->max))
+        tatomic_store_relaxed(&histogram->max, ticks);
+    INCREMENT(&histogram->count, 1);
+    INCREMENT(&histogram->total, ticks);
+    INCREMENT(&histogram->buckets[bucket_index(ticks)], 1);
+}
+
+void
+talloc_get_latency(talloc_latency_op_t op, talloc_latency_path_t path,
+                   talloc_latency_histogram_t *histogram)
+{
+    memset(histogram, 0, sizeof(talloc_latency_histogram_t));
+    if ((unsigned)op >= TALLOC_LATENCY_OP_COUNT || (unsigned)path >= TALLOC_PATH_COUNT)
+        return;
+    LOCK(records_flag);
+    for (latency_record_t *record = records; record; record = record->next) {
+        latency_histogram_t *source = &record->histograms[op][path];
+        const uint64_t count = tatomic_load_relaxed(&source->count);
+        if (!count)
+            continue;
+        const uint64_t min = tatomic_load_relaxed(&source->min);
+        const uint64_t max = tatomic_load_relaxed(&source->max);
+        if (!histogram->count || min < histogram->min)
+            histogram->min = min;
+        if (max > histogram->max)
+            histogram->max = max;
+        histogram->count += count;
+        histogram->total += tatomic_load_relaxed(&source->total);
+        for (size_t i = 0; i < TALLOC_LATENCY_BUCKETS; i++)
+            histogram->buckets[i] += tatomic_load_relaxed(&source->buckets[i]);
+    }
+    UNLOCK(records_flag);
+}
+
+void
+talloc_reset_latency(void)
+{
+    LOCK(records_flag);
+    for (latency_record_t *record = records; record; record = record->next) {
+        for (size_t op = 0; op < TALLOC_LATENCY_OP_COUNT; op++) {
+            for (size_t path = 0; path < TALLOC_PATH_COUNT; path++) {
+                latency_histogram_t *histogram = &record->histograms[op][path];
+                tatomic_store_relaxed(&histogram->count, 0);
+                tatomic_store_relaxed(&histogram->total, 0);
+                tatomic_store_relaxed(&histogram->min, 0);
+                tatomic_store_relaxed(&histogram->max, 0);
+                for (size_t i = 0; i < TALLOC_LATENCY_BUCKETS; i++)
+                    tatomic_store_relaxed(&histogram->buckets[i], 0);
+            }
+        }
+    }
+    UNLOCK(records_flag);
+}
+#endif
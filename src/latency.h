@@ -0,0 +1,89 @@
+//*****************************************************************************
+// talloc
+//
+// File:   latency.h
+// Author: Martin Dorazil
+// Date:   19/10/2026
+//
+// Copyright 2017 Martin Dorazil
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+
+#ifndef LATENCY_H_T5NW2KDE
+#define LATENCY_H_T5NW2KDE
+
+#include <stdint.h>
+#include "talloc/talloc.h"
+#include "utils.h"
+
+#if TALLOC_LATENCY_STATS
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#elif !defined(__aarch64__)
+#include <time.h>
+#endif
+
+// slowest path reached by current call of thread
+extern THREAD_LOCAL unsigned latency_path;
+
+static inline uint64_t
+latency_now(void)
+{
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/**
+ * Start measured call which takes at least path.
+ */
+static inline uint64_t
+latency_begin(talloc_latency_path_t path)
+{
+    latency_path = path;
+    return latency_now();
+}
+
+/**
+ * Count call started at start into histogram of current thread.
+ */
+void
+latency_end(talloc_latency_op_t op, uint64_t start);
+
+// paths are ordered by cost, slower path reached by call wins
+#define LATENCY_PATH(path)                                                                         \
+    if ((unsigned)(path) > latency_path)                                                           \
+        latency_path = (path)
+#else
+#define LATENCY_PATH(path)
+#endif
+
+#endif /* end of include guard: LATENCY_H_T5NW2KDE */
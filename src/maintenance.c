@@ -0,0 +1,169 @@
+//*****************************************************************************
+// talloc
+//
+// File:   maintenance.c
+// Author: Martin Dorazil
+// Date:   19/10/2026
+//
+// Copyright 2017 Martin Dorazil
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+
+#include "maintenance.h"
+#include "heap.h"
+#include "pool.h"
+#include "utils.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <time.h>
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static pthread_t thread;
+static bool running;
+static unsigned interval;
+#endif
+
+static tatomic_bool stats_flag;
+static talloc_maintenance_stats_t stats;
+
+#ifndef _WIN32
+// one maintenance pass, every step only tries allocator locks except returning
+// released slabs to heap which is done with no pool lock held
+static void
+run_pass(size_t pass)
+{
+    const size_t released = pool_trim(&global_pool);
+    const bool purged =
+        heap_purge_step(&global_heap, TALLOC_MAINTENANCE_DECAY, TALLOC_MAINTENANCE_BUDGET);
+#if TALLOC_MAINTENANCE_FLUSH_PASSES
+    if (pass % TALLOC_MAINTENANCE_FLUSH_PASSES == 0)
+        pool_request_flush();
+#endif
+
+    // usage of busy heap is refreshed by one of next passes
+    size_t allocated, used, largest_free;
+    const bool measured = heap_usage(&global_heap, &allocated, &used, &largest_free);
+    LOCK(stats_flag);
+    stats.passes++;
+    stats.skipped += !purged;
+    stats.released_slabs += released;
+    if (measured) {
+        stats.allocated = allocated;
+        stats.used = used;
+        stats.largest_free = largest_free;
+    }
+    UNLOCK(stats_flag);
+}
+
+// interval +-25% so passes of more processes do not synchronize
+static unsigned
+jitter(unsigned ms, uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    const unsigned range = ms / 2;
+    return range ? ms - ms / 4 + (unsigned)(x % range) : ms;
+}
+
+static void *
+maintenance_main(void *arg)
+{
+    (void)arg;
+    uint64_t state = (uint64_t)(uintptr_t)&state | 1;
+    size_t pass = 0;
+    pthread_mutex_lock(&mutex);
+    while (running) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        const unsigned ms = jitter(interval, &state);
+        until.tv_sec += ms / 1000;
+        until.tv_nsec += (long)(ms % 1000) * 1000000;
+        if (until.tv_nsec >= 1000000000) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000;
+        }
+        // sleep until timeout or stop
+        while (running && pthread_cond_timedwait(&cond, &mutex, &until) == 0)
+            ;
+        if (!running)
+            break;
+
+        pthread_mutex_unlock(&mutex);
+        run_pass(++pass);
+        pthread_mutex_lock(&mutex);
+    }
+    pthread_mutex_unlock(&mutex);
+    return NULL;
+}
+#endif
+
+bool
+maintenance_start(unsigned interval_ms)
+{
+#ifdef _WIN32
+    (void)interval_ms;
+    return false;
+#else
+    pthread_mutex_lock(&mutex);
+    if (running) {
+        pthread_mutex_unlock(&mutex);
+        return false;
+    }
+    interval = interval_ms ? interval_ms : 1;
+    running = true;
+    if (pthread_create(&thread, NULL, maintenance_main, NULL)) {
+        running = false;
+        pthread_mutex_unlock(&mutex);
+        return false;
+    }
+    pthread_mutex_unlock(&mutex);
+    return true;
+#endif
+}
+
+void
+maintenance_stop(void)
+{
+#ifndef _WIN32
+    pthread_mutex_lock(&mutex);
+    if (!running) {
+        pthread_mutex_unlock(&mutex);
+        return;
+    }
+    running = false;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&mutex);
+    pthread_join(thread, NULL);
+#endif
+}
+
+void
+maintenance_stats(talloc_maintenance_stats_t *out)
+{
+    LOCK(stats_flag);
+    *out = stats;
+    UNLOCK(stats_flag);
+}
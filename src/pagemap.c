@@ -0,0 +1,127 @@
+//*****************************************************************************
+// talloc
+//
+// File:   pagemap.c
+// Author: Martin Dorazil
+// Date:   19/10/2026
+//
+// Copyright 2017 Martin Dorazil
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#include <stdlib.h>
+#include "pagemap.h"
+#include "talloc/talloc_config.h"
+#include "utils.h"
+
+// three level radix tree indexed by page number
+#if UINTPTR_MAX > 0xFFFFFFFFu
+#define ADDRESS_BITS 48
+#else
+#define ADDRESS_BITS 32
+#endif
+// map granularity is 4 KB for every TALLOC_PAGE_SIZE
+#define MAP_PAGE_SHIFT 12
+#define PAGE_BITS (ADDRESS_BITS - MAP_PAGE_SHIFT)
+#define LEAF_BITS (PAGE_BITS / 3)
+#define MID_BITS (PAGE_BITS / 3)
+#define ROOT_BITS (PAGE_BITS - LEAF_BITS - MID_BITS)
+#define LEAF_SIZE ((size_t)1 << LEAF_BITS)
+#define MID_SIZE ((size_t)1 << MID_BITS)
+#define ROOT_SIZE ((size_t)1 << ROOT_BITS)
+
+#if TALLOC_PAGE_SIZE < 4096 || (TALLOC_PAGE_SIZE & (TALLOC_PAGE_SIZE - 1))
+#error "TALLOC_PAGE_SIZE must be power of two at least 4096"
+#endif
+
+typedef struct leaf {
+    tatomic_ptr spans[LEAF_SIZE];
+} leaf_t;
+
+typedef struct mid {
+    tatomic_ptr leaves[MID_SIZE];
+} mid_t;
+
+static tatomic_ptr root[ROOT_SIZE];
+static tatomic_bool pagemap_flag;
+
+static inline uintptr_t
+page_number(uintptr_t addr)
+{
+    return addr >> MAP_PAGE_SHIFT;
+}
+
+static leaf_t *
+get_leaf(uintptr_t page, bool create)
+{
+    const size_t root_id = (size_t)(page >> (LEAF_BITS + MID_BITS));
+    const size_t mid_id = (size_t)(page >> LEAF_BITS) & (MID_SIZE - 1);
+
+    mid_t *mid = (mid_t *)tatomic_load(&root[root_id]);
+    if (!mid) {
+        if (!create)
+            return NULL;
+        // nodes live in system memory and are never released
+        mid = (mid_t *)calloc(1, sizeof(mid_t));
+        if (!mid)
+            ABORT("bad allocation");
+        tatomic_store(&root[root_id], mid);
+    }
+
+    leaf_t *leaf = (leaf_t *)tatomic_load(&mid->leaves[mid_id]);
+    if (!leaf) {
+        if (!create)
+            return NULL;
+        leaf = (leaf_t *)calloc(1, sizeof(leaf_t));
+        if (!leaf)
+            ABORT("bad allocation");
+        tatomic_store(&mid->leaves[mid_id], leaf);
+    }
+    return leaf;
+}
+
+void
+pagemap_set(uintptr_t begin, uintptr_t end, span_t *span)
+{
+    ASSERT(begin % TALLOC_PAGE_SIZE == 0 && end % TALLOC_PAGE_SIZE == 0,
+           "region is not page aligned");
+    ASSERT(!(end >> ADDRESS_BITS), "address out of page map range");
+
+    LOCK(pagemap_flag);
+    for (uintptr_t page = page_number(begin); page < page_number(end); page++) {
+        leaf_t *leaf = get_leaf(page, true);
+        tatomic_store(&leaf->spans[page & (LEAF_SIZE - 1)], span);
+    }
+    UNLOCK(pagemap_flag);
+}
+
+span_t *
+pagemap_get(const void *ptr)
+{
+    const uintptr_t addr = (uintptr_t)ptr;
+    if (addr >> ADDRESS_BITS)
+        return NULL;
+
+    const uintptr_t page = page_number(addr);
+    leaf_t *leaf = get_leaf(page, false);
+    if (!leaf)
+        return NULL;
+    return (span_t *)tatomic_load(&leaf->spans[page & (LEAF_SIZE - 1)]);
+}
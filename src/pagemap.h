@@ -0,0 +1,69 @@
+//*****************************************************************************
+// talloc
+//
+// File:   pagemap.h
+// Author: Martin Dorazil
+// Date:   19/10/2026
+//
+// Copyright 2017 Martin Dorazil
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#ifndef PAGEMAP_H_Q2WZ7FJD
+#define PAGEMAP_H_Q2WZ7FJD
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum span_kind {
+    SPAN_HEAP = 1,
+    // huge allocation mapped directly
+    SPAN_HUGE,
+} span_kind_t;
+
+struct heap;
+
+/**
+ * Descriptor of continuous page aligned region of system memory.
+ */
+typedef struct span {
+    struct span *next;
+    uintptr_t begin;
+    uintptr_t end;
+    span_kind_t kind;
+    // heap instance which obtained region
+    struct heap *heap;
+} span_t;
+
+/**
+ * Map all pages of region to span descriptor. Region must be page aligned.
+ * Null span removes region from map.
+ */
+void
+pagemap_set(uintptr_t begin, uintptr_t end, span_t *span);
+
+/**
+ * Find span containing address.
+ * @return Span or NULL when address was not obtained by talloc.
+ */
+span_t *
+pagemap_get(const void *ptr);
+
+#endif /* end of include guard: PAGEMAP_H_Q2WZ7FJD */
@@ -0,0 +1,166 @@
+//*****************************************************************************
+// talloc
+//
+// File:   persist.c
+// Author: Martin Dorazil
+// Date:   19/10/2026
+//
+// Copyright 2017 Martin Dorazil
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+
+#include <stdlib.h>
+#include "talloc/talloc.h"
+#include "region.h"
+#include "types.h"
+#include "utils.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct talloc_persist {
+    void *base;
+    size_t size;
+    int fd;
+};
+
+talloc_persist_t *
+talloc_persist_open(const char *path, size_t size, void *base)
+{
+#ifdef _WIN32
+    (void)path, (void)size, (void)base;
+    return NULL;
+#else
+    const int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return NULL;
+    // heap file has only one user at a time
+    struct stat st;
+    if (flock(fd, LOCK_EX | LOCK_NB) || fstat(fd, &st)) {
+        close(fd);
+        return NULL;
+    }
+    const bool created = st.st_size == 0;
+    if (created) {
+        size = NEXT_MULT_OF(size, TALLOC_PAGE_SIZE);
+        if (ftruncate(fd, (off_t)size)) {
+            close(fd);
+            return NULL;
+        }
+    } else {
+        size = (size_t)st.st_size;
+    }
+
+    int flags = MAP_SHARED;
+#ifdef MAP_FIXED_NOREPLACE
+    if (base)
+        flags |= MAP_FIXED_NOREPLACE;
+#endif
+    void *mem = mmap(base, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+    talloc_persist_t *persist = (talloc_persist_t *)malloc(sizeof(talloc_persist_t));
+    // base is only a hint for kernels without fixed no-replace mapping
+    const bool mapped = mem != MAP_FAILED && (!base || mem == base);
+    if (!persist || !mapped ||
+        !(created ? region_init(mem, size) : region_open(mem, size))) {
+        if (mem != MAP_FAILED)
+            munmap(mem, size);
+        if (created) {
+            // empty file is formatted again by next open
+            const int truncated = ftruncate(fd, 0);
+            (void)truncated;
+        }
+        free(persist);
+        close(fd);
+        return NULL;
+    }
+    persist->base = mem;
+    persist->size = size;
+    persist->fd = fd;
+    return persist;
+#endif
+}
+
+bool
+talloc_persist_sync(talloc_persist_t *persist)
+{
+#ifdef _WIN32
+    (void)persist;
+    return false;
+#else
+    return msync(persist->base, persist->size, MS_SYNC) == 0;
+#endif
+}
+
+bool
+talloc_persist_check(talloc_persist_t *persist)
+{
+    return region_check(persist->base, persist->size);
+}
+
+void
+talloc_persist_close(talloc_persist_t *persist)
+{
+    if (!persist)
+        return;
+#ifndef _WIN32
+    talloc_persist_sync(persist);
+    munmap(persist->base, persist->size);
+    // closing descriptor releases file lock
+    close(persist->fd);
+#endif
+    free(persist);
+}
+
+void *
+talloc_persist_malloc(talloc_persist_t *persist, size_t count)
+{
+    if (count == 0)
+        return NULL;
+    return region_malloc(persist->base, count);
+}
+
+void
+talloc_persist_free(talloc_persist_t *persist, void *ptr)
+{
+    region_free(persist->base, ptr);
+}
+
+void
+talloc_persist_set_root(talloc_persist_t *persist, void *root)
+{
+    region_set_root(persist->base, root);
+}
+
+void *
+talloc_persist_root(talloc_persist_t *persist)
+{
+    return region_root(persist->base);
+}
+
+void *
+talloc_persist_base(talloc_persist_t *persist)
+{
+    return persist->base;
+}
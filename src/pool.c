@@ -26,14 +26,37 @@
 // SOFTWARE.
 //*****************************************************************************
 
+#include <stdlib.h>
+#include <string.h>
 #include "pool.h"
 #include "talloc/talloc_config.h"
+#include "talloc/talloc_inline.h"
 #include "heap.h"
+#include "latency.h"
 #include "types.h"
 #include "utils.h"
+#if TALLOC_POOL_BITMAP
+#if TALLOC_POOL_LOCK_FREE
+#error "TALLOC_POOL_BITMAP cannot be combined with TALLOC_POOL_LOCK_FREE"
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#elif defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#endif
+#if TALLOC_TCACHE_SIZE
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+#endif
 
 typedef struct pool_meta {
     struct pool_meta *next;
+    // generation of shard when slab was created
+    unsigned generation;
 } pool_meta_t;
 
 typedef struct free_cell_meta {
@@ -41,17 +64,40 @@ typedef struct free_cell_meta {
 } free_cell_meta_t;
 
 typedef struct alloc_cell_meta {
-#if TALLOC_MEM_CHECKING
-    uintptr_t check;
-#endif
     size_t size;
 } alloc_cell_meta_t;
 
+// one shard of size category, every shard takes whole cache line
 typedef struct category {
-    free_cell_meta_t *head;
+#if TALLOC_POOL_LOCK_FREE
+    // tagged pointer to first free cell
+    ALIGNED(TALLOC_CACHE_LINE_SIZE) tatomic_u64 head;
+    pool_meta_t *next_pool;
+    // taken only by slab refill and optimization
+    tatomic_bool flag;
+    tatomic_size used;
+    // count of threads popping from shard
+    tatomic_size inflight;
+    // slabs were reserved, trimming keeps them
+    bool reserved;
+    // generation of innermost mark of pool, slabs of older generations are
+    // set aside by marks
+    unsigned generation;
+#else
+#if TALLOC_POOL_BITMAP
+    // slabs with at least one free cell
+    ALIGNED(TALLOC_CACHE_LINE_SIZE) struct slab *partial;
+#else
+    ALIGNED(TALLOC_CACHE_LINE_SIZE) free_cell_meta_t *head;
+#endif
     pool_meta_t *next_pool;
     tatomic_bool flag;
+    // allocated minus freed cells in this shard, cells can be freed into
+    // another shard so only sum over all shards of category is meaningful
     size_t used;
+    bool reserved;
+    unsigned generation;
+#endif
 } category_t;
 
 #define CATEGORY_COUNT (TALLOC_SMALL_TO / TALLOC_POOL_GROUP_MULT)
@@ -59,24 +105,389 @@ typedef struct category {
 #define FREE_CELL_META_SIZE() sizeof(free_cell_meta_t)
 #define ALLOC_CELL_META_SIZE() sizeof(alloc_cell_meta_t)
 #define POOL_META_SIZE() sizeof(pool_meta_t)
+// offset of first cell of list slab, cells are aligned to TALLOC_ALIGNMENT
+#define LIST_CELLS_OFFSET NEXT_MULT_OF(POOL_META_SIZE() + ALLOC_CELL_META_SIZE(), TALLOC_ALIGNMENT)
+// size of heap block of list slab with room for cache color
+#define LIST_SLAB_SIZE(size)                                                                       \
+    ((TALLOC_INIT_POOL_SIZE * (size)) + LIST_CELLS_OFFSET +                                        \
+     (TALLOC_POOL_COLORS - 1) * TALLOC_CACHE_LINE_SIZE)
 #define MOVE_FREE_CELL_META_PTR(cell, n) (free_cell_meta_t *)((byte_t *)(cell) + (n))
 #define GET_ALLOC_CELL_META(ptr) ((alloc_cell_meta_t *)(ptr)-1);
+#define SHARD_MASK (TALLOC_POOL_SHARDS - 1)
+// count of cells moved from neighbouring shard at once
+#define STEAL_COUNT (TALLOC_INIT_POOL_SIZE / 4)
+
+_Static_assert(TALLOC_HEADER_SIZE == sizeof(alloc_cell_meta_t), "header size mismatch");
+_Static_assert(TALLOC_POOL_COLORS >= 1, "at least one slab color is needed");
+// cells of every size class keep alignment of first cell of slab
+_Static_assert(TALLOC_POOL_GROUP_MULT % TALLOC_ALIGNMENT == 0 &&
+                   TALLOC_CACHE_LINE_SIZE % TALLOC_ALIGNMENT == 0,
+               "pool cells must stay aligned");
+_Static_assert(TALLOC_CLASS_CELL_SIZE(1) == NEXT_MULT_OF(FREE_CELL_META_SIZE() + ALLOC_CELL_META_SIZE(),
+                                                         TALLOC_POOL_GROUP_MULT),
+               "size class mismatch");
+_Static_assert(TALLOC_SIZE_CLASS(TALLOC_SMALL_TO - TALLOC_HEADER_SIZE) == CATEGORY_COUNT - 1,
+               "size class mismatch");
+
+#if TALLOC_POOL_BITMAP
+#define BITMAP_WORDS (TALLOC_POOL_SLAB_SIZE / TALLOC_POOL_GROUP_MULT / 64)
+
+// header at start of every bitmap slab, bit of free cell is set
+typedef struct slab {
+    // link in list of all slabs of shard
+    pool_meta_t meta;
+    struct slab *next_partial;
+    struct slab *prev_partial;
+    // shard which created slab, its lock guards bitmap
+    category_t *shard;
+    // first cell, shifted by cache color
+    byte_t *cells;
+    size_t cell_size;
+    size_t cell_count;
+    // words before hint have no free cell
+    size_t hint;
+    // slab is in partial list of its shard
+    bool partial;
+    uint64_t free[BITMAP_WORDS];
+} slab_t;
+
+#define SLAB_OF(cell) ((slab_t *)((uintptr_t)(cell) & ~(uintptr_t)(TALLOC_POOL_SLAB_SIZE - 1)))
+#define SLAB_CELLS_OFFSET NEXT_MULT_OF(sizeof(slab_t) + ALLOC_CELL_META_SIZE(), TALLOC_ALIGNMENT)
+#define SLAB_WORDS(slab) (((slab)->cell_count + 63) / 64)
+
+#ifdef _MSC_VER
+static inline unsigned
+ctz64(uint64_t value)
+{
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return (unsigned)index;
+}
+#define POPCOUNT64(v) ((size_t)__popcnt64(v))
+#else
+#define ctz64(v) ((unsigned)__builtin_ctzll(v))
+#define POPCOUNT64(v) ((size_t)__builtin_popcountll(v))
+#endif
+
+_Static_assert((TALLOC_POOL_SLAB_SIZE & (TALLOC_POOL_SLAB_SIZE - 1)) == 0,
+               "slab size must be power of two");
+_Static_assert(TALLOC_POOL_SLAB_SIZE >= 8 * TALLOC_SMALL_TO, "slab must hold at least 8 cells");
+#endif
+
+struct pool {
+    category_t categories[CATEGORY_COUNT][TALLOC_POOL_SHARDS];
+    // heap providing slabs
+    heap_t *heap;
+    // innermost mark, linked to older ones
+    pool_mark_t *marks;
+};
+
+struct pool_mark {
+    struct pool_mark *prev;
+    // generation of shards while mark is innermost
+    unsigned generation;
+#if !TALLOC_POOL_BITMAP
+    // free cells of slabs older than mark, cells of these slabs freed since mark
+    // are put here so they are never allocated again before rewind
+    free_cell_meta_t *heads[CATEGORY_COUNT][TALLOC_POOL_SHARDS];
+    // slabs older than mark sorted by address, slabs of category i start at
+    // index first[i]
+    pool_meta_t **sorted;
+    size_t first[CATEGORY_COUNT + 1];
+#endif
+    pool_meta_t *slabs[CATEGORY_COUNT][TALLOC_POOL_SHARDS];
+    size_t used[CATEGORY_COUNT][TALLOC_POOL_SHARDS];
+};
+
+pool_t global_pool = {.heap = &global_heap};
+static tatomic_bool shard_flag;
+// cache color of next slab of any size category
+static tatomic_size next_color;
+static size_t next_shard;
+// shard index + 1 of current thread, 0 when not assigned yet
+static THREAD_LOCAL size_t thread_shard;
+
+#if TALLOC_TCACHE_SIZE
+_Static_assert(TALLOC_CLASS_COUNT == CATEGORY_COUNT, "class count mismatch");
+// count of cells moved between thread cache and shard at once
+#define TCACHE_BATCH (TALLOC_TCACHE_SIZE / 2 ? TALLOC_TCACHE_SIZE / 2 : 1)
+
+#if TALLOC_INLINE_FAST_PATH
+// accessed directly by talloc_inline.h
+TALLOC_EXPORT THREAD_LOCAL talloc_tcache_t talloc_tcache;
+#else
+static THREAD_LOCAL talloc_tcache_t talloc_tcache;
+#endif
+static THREAD_LOCAL bool tcache_registered;
+// threads flush their cache on next call when generation changes
+static tatomic_size flush_generation;
+static THREAD_LOCAL size_t tcache_generation;
+#ifdef _WIN32
+static DWORD tcache_key = FLS_OUT_OF_INDEXES;
+static INIT_ONCE key_once = INIT_ONCE_STATIC_INIT;
+#else
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key;
+#endif
+#endif
+
+// threads get shards in round robin order on first pool access
+static inline size_t
+shard_index(void)
+{
+    if (!thread_shard) {
+        LOCK(shard_flag);
+        thread_shard = (next_shard++ & SHARD_MASK) + 1;
+        UNLOCK(shard_flag);
+    }
+    return thread_shard - 1;
+}
+
+#if TALLOC_POOL_BITMAP
+//*****************************************************************************
+// BITMAP SLABS
+//*****************************************************************************
+// Slab is aligned to TALLOC_POOL_SLAB_SIZE and keeps bit per cell, set bit
+// marks free cell. Cells are taken from lowest address by count trailing zeros
+// and freed cells of one bitmap word are returned by single or. Every slab
+// belongs to shard which created it, cells freed by any thread go back to it.
+static void
+push_partial(category_t *category, slab_t *slab)
+{
+    slab->partial = true;
+    slab->prev_partial = NULL;
+    slab->next_partial = category->partial;
+    if (category->partial)
+        category->partial->prev_partial = slab;
+    category->partial = slab;
+}
+
+static void
+remove_partial(category_t *category, slab_t *slab)
+{
+    if (slab->prev_partial)
+        slab->prev_partial->next_partial = slab->next_partial;
+    else
+        category->partial = slab->next_partial;
+    if (slab->next_partial)
+        slab->next_partial->prev_partial = slab->prev_partial;
+    slab->partial = false;
+}
+
+// allocate new slab with all cells free and put it into partial list
+static slab_t *
+new_slab(heap_t *heap, category_t *category, size_t size)
+{
+    LATENCY_PATH(TALLOC_PATH_REFILL);
+    // heap block of slab ends right where next aligned slab can start
+    const size_t slab_size =
+        TALLOC_POOL_SLAB_SIZE - (heap_block_size(TALLOC_ALIGNMENT) - TALLOC_ALIGNMENT);
+    slab_t *slab = (slab_t *)heap_malloc_aligned(heap, slab_size, TALLOC_POOL_SLAB_SIZE);
+    if (!slab)
+        return NULL;
+    PROBE2(new_category, (void *)slab, size);
+
+    slab->meta.next = category->next_pool;
+    slab->meta.generation = category->generation;
+    category->next_pool = &slab->meta;
+    slab->shard = category;
+    slab->cell_size = size;
+    slab->hint = 0;
+    slab->cell_count = (slab_size - SLAB_CELLS_OFFSET + ALLOC_CELL_META_SIZE()) / size;
+    // color is shifted within unused tail of slab
+    const size_t tail =
+        slab_size - SLAB_CELLS_OFFSET + ALLOC_CELL_META_SIZE() - slab->cell_count * size;
+    size_t colors = tail / TALLOC_CACHE_LINE_SIZE + 1;
+    if (colors > TALLOC_POOL_COLORS)
+        colors = TALLOC_POOL_COLORS;
+    slab->cells = (byte_t *)slab + SLAB_CELLS_OFFSET +
+                  (tatomic_add(&next_color, 1) % colors) * TALLOC_CACHE_LINE_SIZE;
+    byte_t *cell = slab->cells;
+    memset(slab->free, 0, sizeof(slab->free));
+    for (size_t i = 0; i < slab->cell_count; i++, cell += size) {
+        alloc_cell_meta_t *meta = GET_ALLOC_CELL_META(cell);
+        meta->size = size;
+        slab->free[i / 64] |= UINT64_C(1) << (i % 64);
+    }
+    push_partial(category, slab);
+    return slab;
+}
+
+// index of first bitmap word with free cell starting at from
+static size_t
+find_free_word(const slab_t *slab, size_t from)
+{
+    const size_t words = SLAB_WORDS(slab);
+    size_t i = from;
+#if defined(__AVX2__)
+    for (; i + 4 <= words; i += 4) {
+        const __m256i v = _mm256_loadu_si256((const __m256i *)&slab->free[i]);
+        if (!_mm256_testz_si256(v, v))
+            break;
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    for (; i + 2 <= words; i += 2) {
+        const __m128i v = _mm_loadu_si128((const __m128i *)&slab->free[i]);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xffff)
+            break;
+    }
+#endif
+    while (i < words && !slab->free[i])
+        i++;
+    return i;
+}
 
-static category_t categories[CATEGORY_COUNT];
+static size_t
+free_count(const slab_t *slab)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < SLAB_WORDS(slab); i++)
+        count += POPCOUNT64(slab->free[i]);
+    return count;
+}
 
+// take list of up to count free cells of partial slab in address order
+static free_cell_meta_t *
+take_cells(category_t *category, size_t *count)
+{
+    slab_t *slab = category->partial;
+    byte_t *cells = slab->cells;
+    const size_t words = SLAB_WORDS(slab);
+    free_cell_meta_t *first = NULL;
+    free_cell_meta_t **tail = &first;
+    size_t n = 0;
+    size_t w = find_free_word(slab, slab->hint);
+    while (n < *count && w < words) {
+        uint64_t word = slab->free[w];
+        for (; word && n < *count; n++) {
+            free_cell_meta_t *cell =
+                (free_cell_meta_t *)(cells + (w * 64 + ctz64(word)) * slab->cell_size);
+            word &= word - 1;
+            *tail = cell;
+            tail = &cell->next;
+        }
+        slab->free[w] = word;
+        if (!word)
+            w = find_free_word(slab, w + 1);
+    }
+    *tail = NULL;
+    slab->hint = w;
+    if (w == words)
+        remove_partial(category, slab);
+    *count = n;
+    return first;
+}
+
+// take list of up to count cells from own shard or neighbouring shard which is
+// not locked
+static free_cell_meta_t *
+allocate_batch(heap_t *heap, category_t *shards, size_t size, size_t *count)
+{
+    const size_t own = shard_index();
+    category_t *category = &shards[own];
+    LOCK(category->flag);
+
+    for (size_t i = 1; !category->partial && i < TALLOC_POOL_SHARDS; i++) {
+        category_t *neighbour = &shards[(own + i) & SHARD_MASK];
+        // never wait for another shard while holding own lock
+        if (!TRY_LOCK(neighbour->flag))
+            continue;
+        if (neighbour->partial) {
+            UNLOCK(category->flag);
+            free_cell_meta_t *first = take_cells(neighbour, count);
+            UNLOCK(neighbour->flag);
+            return first;
+        }
+        UNLOCK(neighbour->flag);
+    }
+    if (!category->partial && !new_slab(heap, category, size)) {
+        UNLOCK(category->flag);
+        return NULL;
+    }
+    ASSERT(category->partial->cell_size == size, "pool corrupted");
+    free_cell_meta_t *first = take_cells(category, count);
+    UNLOCK(category->flag);
+    return first;
+}
+
+// set bits of freed cells of one bitmap word, shard of slab must be locked
+static void
+free_cells(slab_t *slab, size_t word, uint64_t mask)
+{
+#if TALLOC_MEM_CHECKING
+    if (slab->free[word] & mask) {
+        ABORT("pointer being freed was not allocated");
+    }
+#endif
+    slab->free[word] |= mask;
+    if (word < slab->hint)
+        slab->hint = word;
+    // slabs older than innermost mark stay set aside until rewind
+    if (!slab->partial && slab->meta.generation == slab->shard->generation)
+        push_partial(slab->shard, slab);
+}
+
+// return list of count cells from first to last into their slabs, cells of
+// same slab word are freed at once
 static void
-new_category(category_t *category, size_t size)
+deallocate_batch(category_t *shards, free_cell_meta_t *first, free_cell_meta_t *last,
+                 size_t count)
 {
-    // allocate space for n objects of size on global heap
-    void *new_head =
-        heap_malloc((TALLOC_INIT_POOL_SIZE * size) + POOL_META_SIZE() + ALLOC_CELL_META_SIZE());
+    (void)shards, (void)last;
+    category_t *locked = NULL;
+    slab_t *slab = NULL;
+    size_t word = 0;
+    uint64_t mask = 0;
+    free_cell_meta_t *cell = first;
+    for (size_t i = 0; i < count; i++, cell = cell->next) {
+        slab_t *cell_slab = SLAB_OF(cell);
+        const size_t offset = (size_t)((byte_t *)cell - cell_slab->cells);
+        const size_t index = offset / cell_slab->cell_size;
+#if TALLOC_MEM_CHECKING
+        if (offset % cell_slab->cell_size || index >= cell_slab->cell_count) {
+            ABORT("pointer being freed was not allocated");
+        }
+#endif
+        if (cell_slab != slab || index / 64 != word) {
+            if (mask)
+                free_cells(slab, word, mask);
+            if (cell_slab->shard != locked) {
+                if (locked)
+                    UNLOCK(locked->flag);
+                locked = cell_slab->shard;
+                LOCK(locked->flag);
+            }
+            slab = cell_slab;
+            word = index / 64;
+            mask = 0;
+        }
+        mask |= UINT64_C(1) << (index % 64);
+    }
+    if (mask)
+        free_cells(slab, word, mask);
+    if (locked)
+        UNLOCK(locked->flag);
+}
+#else
+// allocate new slab and return list of its cells
+static free_cell_meta_t *
+new_category(heap_t *heap, category_t *category, size_t size)
+{
+    LATENCY_PATH(TALLOC_PATH_REFILL);
+    // allocate space for n objects of size on heap with room for cache color
+    void *new_head = heap_malloc(heap, LIST_SLAB_SIZE(size));
+    if (!new_head)
+        return NULL;
     pool_meta_t *new_pool = (pool_meta_t *)new_head;
+    PROBE2(new_category, (void *)new_pool, size);
 
     // store linked list of pools in category (for future freeing)
     new_pool->next = category->next_pool;
+    new_pool->generation = category->generation;
     category->next_pool = new_pool;
 
-    new_head = (byte_t *)new_head + POOL_META_SIZE() + ALLOC_CELL_META_SIZE();
+    new_head = (byte_t *)new_head + LIST_CELLS_OFFSET +
+               (tatomic_add(&next_color, 1) % TALLOC_POOL_COLORS) * TALLOC_CACHE_LINE_SIZE;
     free_cell_meta_t *iter = (free_cell_meta_t *)new_head;
     alloc_cell_meta_t *buf = NULL;
     for (size_t i = 0; i < TALLOC_INIT_POOL_SIZE - 1;
@@ -84,69 +495,744 @@ new_category(category_t *category, size_t size)
         iter->next = MOVE_FREE_CELL_META_PTR(iter, size);
         buf = GET_ALLOC_CELL_META(iter);
         buf->size = size;
-#if TALLOC_MEM_CHECKING
-        buf->check = (uintptr_t)iter;
-#endif
     }
     iter->next = NULL;
     buf = GET_ALLOC_CELL_META(iter);
     buf->size = size;
-#if TALLOC_MEM_CHECKING
-    buf->check = (uintptr_t)iter;
+
+    return new_head;
+}
+
+// find last of up to count cells starting at first
+static free_cell_meta_t *
+cut_list(free_cell_meta_t *first, size_t *count)
+{
+    free_cell_meta_t *last = first;
+    size_t n = 1;
+    for (; n < *count && last->next; n++)
+        last = last->next;
+    *count = n;
+    return last;
+}
+
+#if TALLOC_POOL_LOCK_FREE
+//*****************************************************************************
+// LOCK-FREE SHARDS
+//*****************************************************************************
+// Head of shard is pointer packed with version tag which is incremented by
+// every change of head, compare and swap of stale head always fails so popped
+// cell reused and pushed back (ABA) is detected. Cells of slab can be read by
+// thread which lost the race, so slabs are released only when no pop is in
+// flight.
+#if UINTPTR_MAX > 0xffffffffu
+// user space addresses fit into 48 bits
+#define TAG_SHIFT 48
+#else
+#define TAG_SHIFT 32
+#endif
+#define PTR_MASK ((UINT64_C(1) << TAG_SHIFT) - 1)
+#define HEAD_PTR(head) ((free_cell_meta_t *)(uintptr_t)((head)&PTR_MASK))
+#define HEAD_MAKE(ptr, prev) ((uint64_t)(uintptr_t)(ptr) | (((prev) >> TAG_SHIFT) + 1) << TAG_SHIFT)
+#ifdef __SANITIZE_THREAD__
+#define NO_SANITIZE_THREAD __attribute__((no_sanitize_thread))
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define NO_SANITIZE_THREAD __attribute__((no_sanitize("thread")))
 #endif
+#endif
+#ifndef NO_SANITIZE_THREAD
+#define NO_SANITIZE_THREAD
+#endif
+
+// next of head cell is read while thread which popped it may already write it,
+// the stale value is rejected by compare and swap. Pool accesses of next are
+// atomic, race with user data written into reused cell is expected.
+static inline NO_SANITIZE_THREAD free_cell_meta_t *
+load_next(free_cell_meta_t *cell)
+{
+    return (free_cell_meta_t *)tatomic_load_relaxed((tatomic_ptr *)&cell->next);
+}
+
+#define STORE_NEXT(cell, ptr) tatomic_store_relaxed((tatomic_ptr *)&(cell)->next, (void *)(ptr))
+
+static void
+push_list(category_t *category, free_cell_meta_t *first, free_cell_meta_t *last)
+{
+    uint64_t head = tatomic_load(&category->head);
+    do {
+        STORE_NEXT(last, HEAD_PTR(head));
+    } while (!tatomic_cas(&category->head, &head, HEAD_MAKE(first, head)));
+}
+
+// pop up to count cells one by one, next pointer of cell popped by another
+// thread can be already overwritten by user data so only head cell is ever
+// read, cells are counted as used before they are taken so optimize never
+// sees them free
+static free_cell_meta_t *
+pop_list(category_t *category, size_t *count)
+{
+    free_cell_meta_t *first = NULL;
+    size_t n = 0;
+    tatomic_add(&category->inflight, 1);
+    tatomic_add(&category->used, *count);
+    uint64_t head = tatomic_load(&category->head);
+    while (n < *count) {
+        free_cell_meta_t *cell = HEAD_PTR(head);
+        if (!cell)
+            break;
+        if (!tatomic_cas(&category->head, &head, HEAD_MAKE(load_next(cell), head)))
+            continue;
+        STORE_NEXT(cell, first);
+        first = cell;
+        n++;
+        head = tatomic_load(&category->head);
+    }
+    if (n < *count)
+        tatomic_sub(&category->used, *count - n);
+    tatomic_sub(&category->inflight, 1);
+
+    *count = n;
+    return first;
+}
+
+// take whole list of shard, no cell is read so no pop is in flight
+static free_cell_meta_t *
+take_list(category_t *category)
+{
+    uint64_t head = tatomic_load(&category->head);
+    while (!tatomic_cas(&category->head, &head, HEAD_MAKE(NULL, head)))
+        ;
+    return HEAD_PTR(head);
+}
+
+static void
+put_list(category_t *category, free_cell_meta_t *first)
+{
+    if (!first)
+        return;
+    size_t count = SIZE_MAX;
+    push_list(category, first, cut_list(first, &count));
+}
+
+static free_cell_meta_t *
+allocate_batch(heap_t *heap, category_t *shards, size_t size, size_t *count)
+{
+    const size_t own = shard_index();
+    size_t n = *count;
+    free_cell_meta_t *first = pop_list(&shards[own], &n);
+    for (size_t i = 1; !first && i < TALLOC_POOL_SHARDS; i++) {
+        n = *count;
+        first = pop_list(&shards[(own + i) & SHARD_MASK], &n);
+    }
+
+    if (!first) {
+        // only slab refill takes lock
+        category_t *category = &shards[own];
+        LOCK(category->flag);
+        n = *count;
+        first = pop_list(category, &n);
+        if (!first) {
+            first = new_category(heap, category, size);
+            if (!first) {
+                UNLOCK(category->flag);
+                return NULL;
+            }
+            n = *count;
+            free_cell_meta_t *last = cut_list(first, &n);
+            tatomic_add(&category->used, n);
+            if (last->next)
+                put_list(category, last->next);
+            last->next = NULL;
+        }
+        UNLOCK(category->flag);
+    }
+
+    const alloc_cell_meta_t *meta = GET_ALLOC_CELL_META(first);
+    ASSERT(meta->size == size, "pool corrupted");
+    *count = n;
+    return first;
+}
+
+// return list of count cells from first to last into own shard
+static void
+deallocate_batch(category_t *shards, free_cell_meta_t *first, free_cell_meta_t *last,
+                 size_t count)
+{
+    category_t *category = &shards[shard_index()];
+    // cells must be in list before they stop being counted as used
+    push_list(category, first, last);
+    tatomic_sub(&category->used, count);
+}
+#else
+// move free cells from first neighbouring shard which is not locked
+static bool
+steal(category_t *shards, size_t own)
+{
+    category_t *category = &shards[own];
+    for (size_t i = 1; i < TALLOC_POOL_SHARDS; i++) {
+        category_t *neighbour = &shards[(own + i) & SHARD_MASK];
+        // never wait for another shard while holding own lock
+        if (!TRY_LOCK(neighbour->flag))
+            continue;
 
-    category->head = new_head;
+        free_cell_meta_t *first = neighbour->head;
+        if (!first) {
+            UNLOCK(neighbour->flag);
+            continue;
+        }
+        size_t count = STEAL_COUNT;
+        free_cell_meta_t *last = cut_list(first, &count);
+        neighbour->head = last->next;
+        UNLOCK(neighbour->flag);
+
+        last->next = category->head;
+        category->head = first;
+        return true;
+    }
+    return false;
 }
 
+// take list of up to count cells from own shard
 static free_cell_meta_t *
-allocate(category_t *category, size_t size)
+allocate_batch(heap_t *heap, category_t *shards, size_t size, size_t *count)
 {
+    const size_t own = shard_index();
+    category_t *category = &shards[own];
     LOCK(category->flag);
 
-    if (category->head == NULL)
-        new_category(category, size);
-    free_cell_meta_t *ret = category->head;
-    alloc_cell_meta_t *meta = GET_ALLOC_CELL_META(ret);
-    ASSERT(meta->check == (uintptr_t)ret, "pool corrupted");
-    category->head = category->head->next;
-    category->used++;
+    if (category->head == NULL && !steal(shards, own) &&
+        !(category->head = new_category(heap, category, size))) {
+        UNLOCK(category->flag);
+        return NULL;
+    }
+    free_cell_meta_t *first = category->head;
+    const alloc_cell_meta_t *meta = GET_ALLOC_CELL_META(first);
+    ASSERT(meta->size == size, "pool corrupted");
+    free_cell_meta_t *last = cut_list(first, count);
+    category->head = last->next;
+    category->used += *count;
     UNLOCK(category->flag);
 
-    return ret;
+    last->next = NULL;
+    return first;
+}
+
+// return list of count cells from first to last into own shard
+static void
+deallocate_batch(category_t *shards, free_cell_meta_t *first, free_cell_meta_t *last,
+                 size_t count)
+{
+    category_t *category = &shards[shard_index()];
+    LOCK(category->flag);
+    last->next = category->head;
+    category->head = first;
+    category->used -= count;
+    UNLOCK(category->flag);
+}
+#endif
+#endif
+
+#if TALLOC_TCACHE_SIZE
+//*****************************************************************************
+// THREAD CACHE
+//*****************************************************************************
+static void
+tcache_flush_bin(size_t category_id, size_t count)
+{
+    talloc_tcache_bin_t *bin = &talloc_tcache.bins[category_id];
+    free_cell_meta_t *first = bin->head;
+    if (!first)
+        return;
+    free_cell_meta_t *last = first;
+    size_t n = 1;
+    for (; n < count && last->next; n++)
+        last = last->next;
+    bin->head = last->next;
+    bin->space += n;
+    deallocate_batch(global_pool.categories[category_id], first, last, n);
+}
+
+static void
+tcache_flush(void)
+{
+    for (size_t i = 0; i < CATEGORY_COUNT; i++)
+        tcache_flush_bin(i, TALLOC_TCACHE_SIZE);
+}
+
+#ifdef _WIN32
+static void WINAPI
+release_tcache(void *data)
+#else
+static void
+release_tcache(void *data)
+#endif
+{
+    (void)data;
+    tcache_flush();
+    // allocation in later destructors registers cache again
+    tcache_registered = false;
+    for (size_t i = 0; i < CATEGORY_COUNT; i++)
+        talloc_tcache.bins[i].space = 0;
+}
+
+#ifdef _WIN32
+static BOOL CALLBACK
+create_key(PINIT_ONCE once, void *param, void **ctx)
+{
+    (void)once, (void)param, (void)ctx;
+    tcache_key = FlsAlloc(release_tcache);
+    return TRUE;
+}
+#else
+static void
+create_key(void)
+{
+    pthread_key_create(&tcache_key, release_tcache);
+}
+#endif
+
+// thread cache is flushed into shards when thread exits
+static void
+tcache_register(void)
+{
+    tcache_registered = true;
+#ifdef _WIN32
+    InitOnceExecuteOnce(&key_once, create_key, NULL, NULL);
+    FlsSetValue(tcache_key, &talloc_tcache);
+#else
+    pthread_once(&key_once, create_key);
+    pthread_setspecific(tcache_key, &talloc_tcache);
+#endif
+    for (size_t i = 0; i < CATEGORY_COUNT; i++)
+        talloc_tcache.bins[i].space = TALLOC_TCACHE_SIZE;
+}
+
+static inline void
+tcache_check_flush(void)
+{
+    const size_t generation = tatomic_load(&flush_generation);
+    if (generation != tcache_generation) {
+        tcache_generation = generation;
+        tcache_flush();
+    }
+}
+
+static void *
+tcache_pop(size_t category_id)
+{
+    talloc_tcache_bin_t *bin = &talloc_tcache.bins[category_id];
+    free_cell_meta_t *cell = bin->head;
+    if (!cell) {
+        if (!tcache_registered)
+            tcache_register();
+        size_t count = TCACHE_BATCH;
+        cell = allocate_batch(global_pool.heap, global_pool.categories[category_id],
+                              (category_id + 1) * TALLOC_POOL_GROUP_MULT, &count);
+        if (!cell)
+            return NULL;
+        bin->space -= count;
+    }
+    const alloc_cell_meta_t *meta = GET_ALLOC_CELL_META(cell);
+    ASSERT(meta->size == (category_id + 1) * TALLOC_POOL_GROUP_MULT, "pool corrupted");
+    bin->head = cell->next;
+    bin->space++;
+    return cell;
 }
 
 static void
-deallocate(category_t *category, free_cell_meta_t *free_cell)
+tcache_push(size_t category_id, free_cell_meta_t *cell)
 {
+    talloc_tcache_bin_t *bin = &talloc_tcache.bins[category_id];
+    if (!bin->space) {
+        if (tcache_registered)
+            tcache_flush_bin(category_id, TCACHE_BATCH);
+        else
+            tcache_register();
+    }
+    cell->next = bin->head;
+    bin->head = cell;
+    bin->space--;
+}
+#endif
+
+#if !TALLOC_POOL_BITMAP
+// find slab of category recorded by mark which contains cell
+static const pool_meta_t *
+find_marked_slab(const pool_mark_t *mark, size_t category_id, const void *cell)
+{
+    const size_t size = (category_id + 1) * TALLOC_POOL_GROUP_MULT;
+    size_t lo = mark->first[category_id], hi = mark->first[category_id + 1];
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if ((uintptr_t)mark->sorted[mid] <= (uintptr_t)cell)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == mark->first[category_id])
+        return NULL;
+    const pool_meta_t *slab = mark->sorted[lo - 1];
+    return (const byte_t *)cell < (const byte_t *)slab + LIST_SLAB_SIZE(size) ? slab : NULL;
+}
+
+// put freed cell of slab older than innermost mark into free list of oldest mark
+// newer than its slab, cells allocated before mark are reused only after rewind
+static bool
+set_aside(pool_t *pool, size_t category_id, free_cell_meta_t *cell)
+{
+    const pool_meta_t *slab = find_marked_slab(pool->marks, category_id, cell);
+    if (!slab)
+        return false;
+    pool_mark_t *oldest = pool->marks;
+    while (oldest->prev && oldest->prev->generation > slab->generation)
+        oldest = oldest->prev;
+
+    const size_t s = shard_index();
+    category_t *category = &pool->categories[category_id][s];
     LOCK(category->flag);
-    free_cell->next = category->head;
-    category->head = free_cell;
+    cell->next = oldest->heads[category_id][s];
+    oldest->heads[category_id][s] = cell;
+    // cell is not used at any mark rewinding to which keeps it free
+    for (pool_mark_t *mark = pool->marks; mark != oldest->prev; mark = mark->prev)
+        mark->used[category_id][s]--;
+#if TALLOC_POOL_LOCK_FREE
+    tatomic_sub(&category->used, 1);
+#else
     category->used--;
+#endif
     UNLOCK(category->flag);
+    return true;
+}
+#endif
+
+// return cell into pool without thread cache
+static void
+deallocate(pool_t *pool, size_t category_id, free_cell_meta_t *cell)
+{
+#if !TALLOC_POOL_BITMAP
+    if (pool->marks && set_aside(pool, category_id, cell))
+        return;
+#endif
+    deallocate_batch(pool->categories[category_id], cell, cell, 1);
+}
+
+pool_t *
+pool_create(heap_t *heap)
+{
+    pool_t *pool = NULL;
+    // shards must stay on their own cache lines
+#ifdef _MSC_VER
+    pool = (pool_t *)_aligned_malloc(sizeof(pool_t), TALLOC_CACHE_LINE_SIZE);
+#else
+    if (posix_memalign((void **)&pool, TALLOC_CACHE_LINE_SIZE, sizeof(pool_t)))
+        pool = NULL;
+#endif
+    if (!pool)
+        return NULL;
+    memset(pool, 0, sizeof(pool_t));
+    pool->heap = heap;
+    return pool;
+}
+
+void
+pool_destroy(pool_t *pool)
+{
+    ASSERT(pool != &global_pool, "global pool cannot be destroyed");
+    // slabs are released together with heap
+#ifdef _MSC_VER
+    _aligned_free(pool);
+#else
+    free(pool);
+#endif
 }
 
 void *
-pool_malloc(size_t count)
+pool_malloc(pool_t *pool, size_t count)
+{
+    return pool_class_malloc(pool, SIZE_TO_CATEGORY(pool_cell_size(count)));
+}
+
+void *
+pool_class_malloc(pool_t *pool, size_t category_id)
 {
-    count = pool_cell_size(count);
-    const size_t category_id = SIZE_TO_CATEGORY(count);
     ASSERT(category_id < CATEGORY_COUNT, "pool category overflow");
-    category_t *category = &categories[category_id];
+#if TALLOC_TCACHE_SIZE
+    // thread cache serves only global pool
+    if (pool == &global_pool) {
+        tcache_check_flush();
+        return tcache_pop(category_id);
+    }
+#endif
+    size_t count = 1;
+    return allocate_batch(pool->heap, pool->categories[category_id],
+                          (category_id + 1) * TALLOC_POOL_GROUP_MULT, &count);
+}
 
-    return allocate(category, count);
+void
+pool_class_free(pool_t *pool, void *ptr, size_t category_id)
+{
+    ASSERT(category_id < CATEGORY_COUNT, "pool category overflow");
+#if TALLOC_MEM_CHECKING
+    const alloc_cell_meta_t *cell = GET_ALLOC_CELL_META(ptr);
+    if (SIZE_TO_CATEGORY(cell->size & ~SAMPLED_FLAG) != category_id) {
+        ABORT("pointer being freed was not allocated with this size class");
+    }
+#endif
+#if TALLOC_TCACHE_SIZE
+    if (pool == &global_pool) {
+        tcache_check_flush();
+        tcache_push(category_id, (free_cell_meta_t *)ptr);
+        return;
+    }
+#endif
+    deallocate(pool, category_id, (free_cell_meta_t *)ptr);
 }
 
 void
-pool_free(void *ptr)
+pool_free(pool_t *pool, void *ptr)
 {
     alloc_cell_meta_t *cell = GET_ALLOC_CELL_META(ptr);
     const size_t size = cell->size;
-    ASSERT(cell->check == (uintptr_t)ptr, "pool corrupted");
+    ASSERT(size % TALLOC_POOL_GROUP_MULT == 0, "pool corrupted");
     const size_t category_id = SIZE_TO_CATEGORY(size);
     ASSERT(category_id < CATEGORY_COUNT, "pool category overflow");
-    category_t *category = &categories[category_id];
     free_cell_meta_t *free_cell = (free_cell_meta_t *)ptr;
-    deallocate(category, free_cell);
+#if TALLOC_TCACHE_SIZE
+    if (pool == &global_pool) {
+        tcache_check_flush();
+        tcache_push(category_id, free_cell);
+        return;
+    }
+#endif
+    deallocate(pool, category_id, free_cell);
+}
+
+// shards are always locked in index order, allocation only tries to lock
+// other shards so this never deadlocks
+static void
+lock_shards(category_t *shards)
+{
+    for (size_t i = 0; i < TALLOC_POOL_SHARDS; i++)
+        LOCK(shards[i].flag);
+}
+
+static void
+unlock_shards(category_t *shards)
+{
+    for (size_t i = 0; i < TALLOC_POOL_SHARDS; i++)
+        UNLOCK(shards[i].flag);
+}
+
+// count free cells of all shards, all shards must be locked
+static size_t
+count_free(category_t *shards)
+{
+    size_t count = 0;
+    for (size_t s = 0; s < TALLOC_POOL_SHARDS; s++) {
+#if TALLOC_POOL_BITMAP
+        for (pool_meta_t *meta = shards[s].next_pool; meta; meta = meta->next)
+            count += free_count((slab_t *)meta);
+#else
+#if TALLOC_POOL_LOCK_FREE
+        free_cell_meta_t *head = take_list(&shards[s]);
+#else
+        free_cell_meta_t *head = shards[s].head;
+#endif
+        for (free_cell_meta_t *cell = head; cell; cell = cell->next)
+            count++;
+#if TALLOC_POOL_LOCK_FREE
+        put_list(&shards[s], head);
+#endif
+#endif
+    }
+    return count;
+}
+
+bool
+pool_reserve(pool_t *pool, size_t size, size_t count)
+{
+    const size_t category_id = SIZE_TO_CATEGORY(pool_cell_size(size));
+    ASSERT(category_id < CATEGORY_COUNT, "pool category overflow");
+    const size_t cell_size = (category_id + 1) * TALLOC_POOL_GROUP_MULT;
+    category_t *shards = pool->categories[category_id];
+    category_t *category = &shards[shard_index()];
+
+    lock_shards(shards);
+    // cells of new slab are written so its pages are faulted in
+    for (size_t available = count_free(shards); available < count;) {
+#if TALLOC_POOL_BITMAP
+        slab_t *slab = new_slab(pool->heap, category, cell_size);
+        if (!slab) {
+            unlock_shards(shards);
+            return false;
+        }
+        available += slab->cell_count;
+#else
+        free_cell_meta_t *first = new_category(pool->heap, category, cell_size);
+        if (!first) {
+            unlock_shards(shards);
+            return false;
+        }
+        available += TALLOC_INIT_POOL_SIZE;
+#if TALLOC_POOL_LOCK_FREE
+        put_list(category, first);
+#else
+        size_t n = SIZE_MAX;
+        free_cell_meta_t *last = cut_list(first, &n);
+        last->next = category->head;
+        category->head = first;
+#endif
+#endif
+    }
+    shards[0].reserved = true;
+    unlock_shards(shards);
+    return true;
+}
+
+#if !TALLOC_POOL_BITMAP
+static int
+compare_slabs(const void *a, const void *b)
+{
+    const uintptr_t addr_a = ((const talloc_slab_info_t *)a)->address;
+    const uintptr_t addr_b = ((const talloc_slab_info_t *)b)->address;
+    return (addr_a > addr_b) - (addr_a < addr_b);
+}
+
+// find slab containing cell in slabs sorted by address
+static talloc_slab_info_t *
+find_slab(talloc_slab_info_t *slabs, size_t count, uintptr_t cell)
+{
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (slabs[mid].address <= cell)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo ? &slabs[lo - 1] : NULL;
+}
+#endif
+
+// describe slabs of category from index count, all shards must be locked
+// @return Index after last slab.
+static size_t
+copy_category_slabs(category_t *shards, size_t cell_size, talloc_slab_info_t *slabs,
+                    size_t capacity, size_t count)
+{
+    for (size_t s = 0; s < TALLOC_POOL_SHARDS; s++) {
+        for (pool_meta_t *pool = shards[s].next_pool; pool; pool = pool->next, count++) {
+            if (count >= capacity)
+                continue;
+            talloc_slab_info_t *info = &slabs[count];
+            info->address = (uintptr_t)pool;
+            info->cell_size = cell_size;
+#if TALLOC_POOL_BITMAP
+            const slab_t *slab = (const slab_t *)pool;
+            info->cell_count = slab->cell_count;
+            info->used_cells = slab->cell_count - free_count(slab);
+#else
+            info->cell_count = TALLOC_INIT_POOL_SIZE;
+            info->used_cells = TALLOC_INIT_POOL_SIZE;
+#endif
+        }
+    }
+    return count;
+}
+
+#if !TALLOC_POOL_BITMAP
+// copy addresses of free cells of category, all shards must be locked
+static size_t
+copy_free_cells(category_t *shards, uintptr_t *cells)
+{
+    size_t count = 0;
+    for (size_t s = 0; s < TALLOC_POOL_SHARDS; s++) {
+#if TALLOC_POOL_LOCK_FREE
+        // list is taken out of shard to be walked safely
+        free_cell_meta_t *head = take_list(&shards[s]);
+#else
+        free_cell_meta_t *head = shards[s].head;
+#endif
+        for (free_cell_meta_t *cell = head; cell; cell = cell->next)
+            cells[count++] = (uintptr_t)cell;
+#if TALLOC_POOL_LOCK_FREE
+        put_list(&shards[s], head);
+#endif
+    }
+    return count;
+}
+#endif
+
+size_t
+pool_copy_slabs(pool_t *pool, talloc_slab_info_t *slabs, size_t capacity)
+{
+    size_t count = 0;
+#if !TALLOC_POOL_BITMAP
+    // free cells are copied under lock and counted per slab after unlock, buffer
+    // grows outside of lock; without buffer slabs report all cells used
+    uintptr_t *cells = NULL;
+    size_t cells_capacity = 0;
+    bool out_of_memory = false;
+#endif
+#if TALLOC_TCACHE_SIZE
+    // cells cached by other threads are reported as used
+    if (pool == &global_pool)
+        tcache_flush();
+#endif
+    for (size_t i = 0; i < CATEGORY_COUNT; i++) {
+        category_t *shards = pool->categories[i];
+        const size_t cell_size = (i + 1) * TALLOC_POOL_GROUP_MULT;
+        const size_t first = count;
+        lock_shards(shards);
+        count = copy_category_slabs(shards, cell_size, slabs, capacity, first);
+
+#if TALLOC_POOL_BITMAP
+        unlock_shards(shards);
+#else
+        // free cells of category lie in its slabs, so their count is bounded
+        size_t needed = (count - first) * TALLOC_INIT_POOL_SIZE;
+        while (count <= capacity && needed > cells_capacity && !out_of_memory) {
+            unlock_shards(shards);
+            uintptr_t *tmp = (uintptr_t *)realloc(cells, needed * sizeof(uintptr_t));
+            if (tmp) {
+                cells = tmp;
+                cells_capacity = needed;
+            } else
+                out_of_memory = true;
+            // slabs may change while unlocked
+            lock_shards(shards);
+            count = copy_category_slabs(shards, cell_size, slabs, capacity, first);
+            needed = (count - first) * TALLOC_INIT_POOL_SIZE;
+        }
+        size_t cell_count = 0;
+        if (count <= capacity && needed <= cells_capacity)
+            cell_count = copy_free_cells(shards, cells);
+        unlock_shards(shards);
+
+        // free cells are spread over all category slabs, count them per slab
+        if (cell_count) {
+            talloc_slab_info_t *category_slabs = &slabs[first];
+            const size_t slab_count = count - first;
+            qsort(category_slabs, slab_count, sizeof(talloc_slab_info_t), compare_slabs);
+            for (size_t c = 0; c < cell_count; c++) {
+                talloc_slab_info_t *slab = find_slab(category_slabs, slab_count, cells[c]);
+                ASSERT(slab && slab->used_cells, "pool corrupted");
+                slab->used_cells--;
+            }
+        }
+#endif
+    }
+#if !TALLOC_POOL_BITMAP
+    free(cells);
+#endif
+    return count;
+}
+
+size_t
+pool_usable_size(const void *ptr)
+{
+    const alloc_cell_meta_t *cell = GET_ALLOC_CELL_META(ptr);
+    return (cell->size & ~SAMPLED_FLAG) - ALLOC_CELL_META_SIZE();
 }
 
 size_t
@@ -158,25 +1244,281 @@ pool_cell_size(size_t size)
     return NEXT_MULT_OF(size, TALLOC_POOL_GROUP_MULT);
 }
 
+// return detached slabs to heap, called without shard locks so heap contention
+// does not stall users of the category
+static size_t
+free_slabs(heap_t *heap, pool_meta_t *slabs)
+{
+    size_t released = 0;
+    while (slabs) {
+        pool_meta_t *next = slabs->next;
+        heap_free(heap, slabs);
+        slabs = next;
+        released++;
+    }
+    return released;
+}
+
+#if TALLOC_POOL_BITMAP
+// detach every slab of category with all cells free, all shards must be
+// locked
+static pool_meta_t *
+detach_unused(category_t *shards)
+{
+    pool_meta_t *detached = NULL;
+    for (size_t s = 0; s < TALLOC_POOL_SHARDS; s++) {
+        category_t *c = &shards[s];
+        pool_meta_t **link = &c->next_pool;
+        while (*link) {
+            slab_t *slab = (slab_t *)*link;
+            if (free_count(slab) != slab->cell_count) {
+                link = &slab->meta.next;
+                continue;
+            }
+            *link = slab->meta.next;
+            if (slab->partial)
+                remove_partial(c, slab);
+            slab->meta.next = detached;
+            detached = &slab->meta;
+        }
+        c->reserved = false;
+    }
+    return detached;
+}
+#else
+// detach all slabs of category when none of its cells is used, all shards
+// must be locked
+static pool_meta_t *
+detach_unused(category_t *shards)
+{
+#if TALLOC_POOL_LOCK_FREE
+    // take all free cells out, category is unused only when no cell is counted
+    // as used, no pop is in flight and no head changed since take. Any cell
+    // popped after take was pushed after it and every change of head bumps its
+    // tag, pops count cells as used before they take them and are in flight
+    // while they can read cell of old list
+    free_cell_meta_t *lists[TALLOC_POOL_SHARDS];
+    uint64_t taken[TALLOC_POOL_SHARDS];
+    for (size_t s = 0; s < TALLOC_POOL_SHARDS; s++) {
+        uint64_t head = tatomic_load(&shards[s].head);
+        while (!tatomic_cas(&shards[s].head, &head, HEAD_MAKE(NULL, head)))
+            ;
+        lists[s] = HEAD_PTR(head);
+        taken[s] = HEAD_MAKE(NULL, head);
+    }
+    size_t busy = 0;
+    for (size_t s = 0; s < TALLOC_POOL_SHARDS; s++)
+        busy += tatomic_load(&shards[s].used);
+    for (size_t s = 0; s < TALLOC_POOL_SHARDS; s++)
+        busy += tatomic_load(&shards[s].inflight);
+    for (size_t s = 0; s < TALLOC_POOL_SHARDS; s++)
+        busy += tatomic_load(&shards[s].head) != taken[s];
+    if (busy) {
+        for (size_t s = 0; s < TALLOC_POOL_SHARDS; s++)
+            put_list(&shards[s], lists[s]);
+        return NULL;
+    }
+#else
+    size_t used = 0;
+    for (size_t s = 0; s < TALLOC_POOL_SHARDS; s++)
+        used += shards[s].used;
+    if (used)
+        return NULL;
+#endif
+
+    pool_meta_t *detached = NULL;
+    for (size_t s = 0; s < TALLOC_POOL_SHARDS; s++) {
+        category_t *c = &shards[s];
+        if (c->next_pool) {
+            pool_meta_t *last = c->next_pool;
+            while (last->next)
+                last = last->next;
+            last->next = detached;
+            detached = c->next_pool;
+        }
+        c->next_pool = NULL;
+        c->reserved = false;
+#if !TALLOC_POOL_LOCK_FREE
+        c->head = NULL;
+        c->used = 0;
+#endif
+    }
+    return detached;
+}
+#endif
+
 void
-pool_optimize(void)
+pool_optimize(pool_t *pool)
+{
+#if TALLOC_TCACHE_SIZE
+    // slabs of category are released only when no thread caches its cells
+    if (pool == &global_pool)
+        tcache_flush();
+#endif
+    for (size_t i = 0; i < CATEGORY_COUNT; i++) {
+        category_t *shards = pool->categories[i];
+        lock_shards(shards);
+        pool_meta_t *detached = detach_unused(shards);
+        unlock_shards(shards);
+        free_slabs(pool->heap, detached);
+    }
+    PROBE2(pool_optimize, (void *)pool, heap_allocated(pool->heap));
+}
+
+size_t
+pool_trim(pool_t *pool)
 {
-    category_t *c = NULL;
+    size_t released = 0;
     for (size_t i = 0; i < CATEGORY_COUNT; i++) {
-        c = &categories[i];
-        LOCK(c->flag);
-        // check category, when its not used -> clean up all its allocated pools
-        if (!c->used) {
-            pool_meta_t *current = c->next_pool;
-            pool_meta_t *prev = NULL;
-            while (current) {
-                prev = current;
-                current = current->next;
-                heap_free(prev);
+        category_t *shards = pool->categories[i];
+        // skip category when any of its shards is busy
+        size_t locked = 0;
+        while (locked < TALLOC_POOL_SHARDS && TRY_LOCK(shards[locked].flag))
+            locked++;
+        pool_meta_t *detached = NULL;
+        if (locked == TALLOC_POOL_SHARDS && !shards[0].reserved)
+            detached = detach_unused(shards);
+        while (locked)
+            UNLOCK(shards[--locked].flag);
+        released += free_slabs(pool->heap, detached);
+    }
+    return released;
+}
+
+// free lists and slabs of pool at mark, free cells are put aside so cells
+// allocated after mark always come from new slabs
+#if !TALLOC_POOL_BITMAP
+static int
+compare_metas(const void *a, const void *b)
+{
+    const uintptr_t addr_a = (uintptr_t)*(pool_meta_t *const *)a;
+    const uintptr_t addr_b = (uintptr_t)*(pool_meta_t *const *)b;
+    return (addr_a > addr_b) - (addr_a < addr_b);
+}
+
+// sort slabs recorded by mark, chains are only prepended to and no slab is
+// released while pool is marked so they are walked without lock
+static bool
+sort_marked_slabs(pool_mark_t *mark)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < CATEGORY_COUNT; i++) {
+        mark->first[i] = count;
+        for (size_t s = 0; s < TALLOC_POOL_SHARDS; s++)
+            for (pool_meta_t *meta = mark->slabs[i][s]; meta; meta = meta->next)
+                count++;
+    }
+    mark->first[CATEGORY_COUNT] = count;
+    mark->sorted = (pool_meta_t **)malloc((count ? count : 1) * sizeof(pool_meta_t *));
+    if (!mark->sorted)
+        return false;
+    for (size_t i = 0; i < CATEGORY_COUNT; i++) {
+        pool_meta_t **sorted = &mark->sorted[mark->first[i]];
+        size_t n = 0;
+        for (size_t s = 0; s < TALLOC_POOL_SHARDS; s++)
+            for (pool_meta_t *meta = mark->slabs[i][s]; meta; meta = meta->next)
+                sorted[n++] = meta;
+        qsort(sorted, n, sizeof(pool_meta_t *), compare_metas);
+    }
+    return true;
+}
+#endif
+
+pool_mark_t *
+pool_mark(pool_t *pool)
+{
+    ASSERT(pool != &global_pool, "global pool cannot be marked");
+    pool_mark_t *mark = (pool_mark_t *)malloc(sizeof(pool_mark_t));
+    if (!mark)
+        return NULL;
+    mark->prev = pool->marks;
+    mark->generation = pool->marks ? pool->marks->generation + 1 : 1;
+    for (size_t i = 0; i < CATEGORY_COUNT; i++) {
+        category_t *shards = pool->categories[i];
+        lock_shards(shards);
+        for (size_t s = 0; s < TALLOC_POOL_SHARDS; s++) {
+            category_t *category = &shards[s];
+#if TALLOC_POOL_LOCK_FREE
+            mark->heads[i][s] = take_list(category);
+            mark->used[i][s] = tatomic_load(&category->used);
+#elif TALLOC_POOL_BITMAP
+            // slabs are put aside by generation, partial lists are rebuilt
+            // from bitmaps by rewind
+            while (category->partial)
+                remove_partial(category, category->partial);
+#else
+            mark->heads[i][s] = category->head;
+            mark->used[i][s] = category->used;
+            category->head = NULL;
+#endif
+            mark->slabs[i][s] = category->next_pool;
+            category->generation = mark->generation;
+        }
+        unlock_shards(shards);
+    }
+    pool->marks = mark;
+#if !TALLOC_POOL_BITMAP
+    if (!sort_marked_slabs(mark)) {
+        mark->sorted = NULL;
+        pool_rewind(pool, mark);
+        return NULL;
+    }
+#endif
+    return mark;
+}
+
+void
+pool_rewind(pool_t *pool, pool_mark_t *mark)
+{
+    ASSERT(pool->marks == mark, "only innermost mark can be rewound");
+    const unsigned generation = mark->generation - 1;
+    for (size_t i = 0; i < CATEGORY_COUNT; i++) {
+        category_t *shards = pool->categories[i];
+        lock_shards(shards);
+        for (size_t s = 0; s < TALLOC_POOL_SHARDS; s++) {
+            category_t *category = &shards[s];
+            // current free cells are all in slabs released by heap rewind,
+            // cells of older slabs were set aside
+#if TALLOC_POOL_LOCK_FREE
+            const uint64_t head = tatomic_load(&category->head);
+            tatomic_store(&category->head, HEAD_MAKE(mark->heads[i][s], head));
+            tatomic_store(&category->used, mark->used[i][s]);
+#elif TALLOC_POOL_BITMAP
+            category->partial = NULL;
+            for (pool_meta_t *meta = mark->slabs[i][s]; meta; meta = meta->next) {
+                slab_t *slab = (slab_t *)meta;
+                slab->partial = false;
+                // slabs older than enclosing mark stay set aside
+                if (meta->generation == generation && free_count(slab))
+                    push_partial(category, slab);
             }
-            c->next_pool = NULL;
-            c->head = NULL;
+#else
+            category->head = mark->heads[i][s];
+            category->used = mark->used[i][s];
+#endif
+            category->next_pool = mark->slabs[i][s];
+            category->generation = generation;
         }
-        UNLOCK(c->flag);
+        unlock_shards(shards);
     }
+    pool_drop_mark(pool, mark);
+}
+
+void
+pool_drop_mark(pool_t *pool, pool_mark_t *mark)
+{
+    ASSERT(pool->marks == mark, "only innermost mark can be dropped");
+    pool->marks = mark->prev;
+#if !TALLOC_POOL_BITMAP
+    free(mark->sorted);
+#endif
+    free(mark);
+}
+
+void
+pool_request_flush(void)
+{
+#if TALLOC_TCACHE_SIZE
+    tatomic_store(&flush_generation, tatomic_load(&flush_generation) + 1);
+#endif
 }
@@ -30,17 +30,100 @@
 #define POOL_H_KYOY7HUF
 
 #include <stddef.h>
+#include <stdbool.h>
+#include "talloc/talloc.h"
+#include "heap.h"
+
+typedef struct pool pool_t;
+typedef struct pool_mark pool_mark_t;
+
+// default instance used by global allocator API, only this pool has thread
+// caches
+extern pool_t global_pool;
+
+/**
+ * Create pool instance taking slabs from heap.
+ * @return New pool or NULL when out of memory.
+ */
+pool_t *
+pool_create(heap_t *heap);
+
+/**
+ * Destroy pool instance, its slabs are released with heap.
+ */
+void
+pool_destroy(pool_t *pool);
+
+void *
+pool_malloc(pool_t *pool, size_t count);
+
+void
+pool_free(pool_t *pool, void *ptr);
 
 void *
-pool_malloc(size_t count);
+pool_class_malloc(pool_t *pool, size_t category_id);
 
 void
-pool_free(void *ptr);
+pool_class_free(pool_t *pool, void *ptr, size_t category_id);
 
 size_t
 pool_cell_size(size_t size);
 
+size_t
+pool_usable_size(const void *ptr);
+
+void
+pool_optimize(pool_t *pool);
+
+/**
+ * Create slabs until category serving size has at least count free cells.
+ * @return False when out of memory.
+ */
+bool
+pool_reserve(pool_t *pool, size_t size, size_t count);
+
+/**
+ * Release slabs of unused categories without waiting for locked shards. With
+ * bitmap slabs every empty slab is released.
+ * @return Count of released slabs.
+ */
+size_t
+pool_trim(pool_t *pool);
+
+/**
+ * Ask all threads to flush their cell cache on next pool call.
+ */
+void
+pool_request_flush(void);
+
+/**
+ * Copy description of all pool slabs into slabs when capacity is big enough.
+ * @return Count of pool slabs.
+ */
+size_t
+pool_copy_slabs(pool_t *pool, talloc_slab_info_t *slabs, size_t capacity);
+
+/**
+ * Record free lists and slabs of pool instance, cells allocated since mark
+ * always come from new slabs and cells of older slabs freed since mark are set
+ * aside until rewind. Slabs must not be released while pool is marked.
+ * @return Mark or NULL when out of memory.
+ */
+pool_mark_t *
+pool_mark(pool_t *pool);
+
+/**
+ * Restore free lists and slabs recorded by innermost mark and release the
+ * mark. Slabs allocated since mark must be released by heap rewind.
+ */
+void
+pool_rewind(pool_t *pool, pool_mark_t *mark);
+
+/**
+ * Release innermost mark without restoring pool, cells it set aside are lost
+ * unless older mark is rewound.
+ */
 void
-pool_optimize(void);
+pool_drop_mark(pool_t *pool, pool_mark_t *mark);
 
 #endif /* end of include guard: POOL_H_KYOY7HUF */
@@ -0,0 +1,49 @@
+//*****************************************************************************
+// talloc
+//
+// File:   probes.h
+// Author: Martin Dorazil
+// Date:   19/10/2026
+//
+// Copyright 2017 Martin Dorazil
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+
+#ifndef PROBES_H_Q8XBM3VC
+#define PROBES_H_Q8XBM3VC
+
+#include "talloc/talloc_config.h"
+
+// all probes are in talloc provider, arguments are sizes and addresses
+#if TALLOC_USDT && defined(__linux__)
+#include <sys/sdt.h>
+#define PROBE1(name, a) DTRACE_PROBE1(talloc, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(talloc, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(talloc, name, a, b, c)
+#define PROBES_ENABLED 1
+#else
+#define PROBE1(name, a)
+#define PROBE2(name, a, b)
+#define PROBE3(name, a, b, c)
+#define PROBES_ENABLED 0
+#endif
+
+#endif /* end of include guard: PROBES_H_Q8XBM3VC */
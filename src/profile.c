@@ -0,0 +1,232 @@
+//*****************************************************************************
+// talloc
+//
+// File:   profile.c
+// Author: Martin Dorazil
+// Date:   19/10/2026
+//
+// Copyright 2017 Martin Dorazil
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#include "talloc/talloc_config.h"
+#if TALLOC_PROFILING
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "profile.h"
+#include "types.h"
+
+#ifdef _MSC_VER
+#include <io.h>
+#define write_fd(fd, buf, count) _write((fd), (buf), (unsigned int)(count))
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#define write_fd(fd, buf, count) write((fd), (buf), (count))
+#endif
+
+#if defined(__GLIBC__) || defined(__APPLE__)
+#include <execinfo.h>
+#endif
+
+#define BUCKET_COUNT 1024
+#define PTR_TO_BUCKET(ptr) ((((uintptr_t)(ptr)) >> 4) % BUCKET_COUNT)
+// frames of profile_sample and tmalloc
+#define SKIP_FRAMES 2
+
+typedef struct sample {
+    struct sample *next;
+    void *ptr;
+    size_t size;
+    int depth;
+    void *frames[TALLOC_PROFILE_MAX_DEPTH];
+} sample_t;
+
+THREAD_LOCAL int64_t profile_countdown = TALLOC_PROFILE_SAMPLE_RATE;
+static THREAD_LOCAL uint64_t rnd_state;
+
+static tatomic_bool profile_flag;
+static sample_t *buckets[BUCKET_COUNT];
+static size_t live_count, live_bytes;
+static size_t total_count, total_bytes;
+
+static uint64_t
+rnd_next(void)
+{
+    if (!rnd_state)
+        rnd_state = (uint64_t)(uintptr_t)&rnd_state ^ (uint64_t)time(NULL) ^ 0x9E3779B97F4A7C15ull;
+
+    // xorshift64*
+    rnd_state ^= rnd_state >> 12;
+    rnd_state ^= rnd_state << 25;
+    rnd_state ^= rnd_state >> 27;
+    return rnd_state * 0x2545F4914F6CDD1Dull;
+}
+
+// sampling points are poisson process, distance between them is exponential
+static int64_t
+next_interval(void)
+{
+    const double u = ((double)(rnd_next() >> 11) + 1.0) * (1.0 / 9007199254740992.0);
+    const double interval = -log(u) * TALLOC_PROFILE_SAMPLE_RATE;
+    if (interval < 1.0)
+        return 1;
+    return (int64_t)interval;
+}
+
+bool
+profile_sample(void *ptr, size_t count)
+{
+    profile_countdown = next_interval();
+
+    // samples are stored in system memory so profiler never recurse into talloc
+    sample_t *sample = (sample_t *)malloc(sizeof(sample_t));
+    if (!sample)
+        return false;
+
+    sample->ptr = ptr;
+    sample->size = count;
+    // backtrace is captured directly here so skipped frames are always the same
+#if defined(__GLIBC__) || defined(__APPLE__)
+    void *frames[TALLOC_PROFILE_MAX_DEPTH + SKIP_FRAMES];
+    const int depth = backtrace(frames, TALLOC_PROFILE_MAX_DEPTH + SKIP_FRAMES) - SKIP_FRAMES;
+    sample->depth = depth > 0 ? depth : 0;
+    memcpy(sample->frames, frames + SKIP_FRAMES, sample->depth * sizeof(void *));
+#elif defined(_MSC_VER)
+    sample->depth =
+        CaptureStackBackTrace(SKIP_FRAMES, TALLOC_PROFILE_MAX_DEPTH, sample->frames, NULL);
+#else
+    sample->depth = 0;
+#endif
+
+    sample_t **bucket = &buckets[PTR_TO_BUCKET(ptr)];
+    LOCK(profile_flag);
+    sample->next = *bucket;
+    *bucket = sample;
+    live_count++;
+    live_bytes += count;
+    total_count++;
+    total_bytes += count;
+    UNLOCK(profile_flag);
+    return true;
+}
+
+void
+profile_retire(void *ptr)
+{
+    sample_t **current = &buckets[PTR_TO_BUCKET(ptr)];
+    sample_t *sample = NULL;
+
+    LOCK(profile_flag);
+    while (*current) {
+        if ((*current)->ptr == ptr) {
+            sample = *current;
+            *current = sample->next;
+            live_count--;
+            live_bytes -= sample->size;
+            break;
+        }
+        current = &(*current)->next;
+    }
+    UNLOCK(profile_flag);
+
+    ASSERT(sample, "sampled allocation not found in profile");
+    free(sample);
+}
+
+static bool
+write_all(int fd, const char *buf, size_t count)
+{
+    while (count) {
+        const long written = (long)write_fd(fd, buf, count);
+        if (written <= 0)
+            return false;
+        buf += written;
+        count -= (size_t)written;
+    }
+    return true;
+}
+
+#ifdef __linux__
+// pprof needs memory mappings to symbolize addresses
+static bool
+write_mappings(int fd)
+{
+    const int maps = open("/proc/self/maps", O_RDONLY);
+    if (maps < 0)
+        return true;
+
+    char buf[4096];
+    long count;
+    bool ok = write_all(fd, "\nMAPPED_LIBRARIES:\n", 19);
+    while (ok && (count = (long)read(maps, buf, sizeof(buf))) > 0)
+        ok = write_all(fd, buf, (size_t)count);
+    close(maps);
+    return ok;
+}
+#endif
+
+int
+profile_dump(int fd)
+{
+    // copy samples out so allocating threads are not blocked by file output
+    LOCK(profile_flag);
+    const size_t count = live_count;
+    const size_t bytes = live_bytes;
+    const size_t all_count = total_count;
+    const size_t all_bytes = total_bytes;
+    sample_t *samples = (sample_t *)malloc((count ? count : 1) * sizeof(sample_t));
+    if (!samples) {
+        UNLOCK(profile_flag);
+        return -1;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; i++) {
+        for (sample_t *s = buckets[i]; s; s = s->next)
+            samples[n++] = *s;
+    }
+    UNLOCK(profile_flag);
+    ASSERT(n == count, "profile corrupted");
+
+    char line[64 + TALLOC_PROFILE_MAX_DEPTH * 20];
+    int len = snprintf(line, sizeof(line), "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%d\n",
+                       count, bytes, all_count, all_bytes, TALLOC_PROFILE_SAMPLE_RATE);
+    bool ok = write_all(fd, line, (size_t)len);
+
+    for (size_t i = 0; ok && i < n; i++) {
+        const sample_t *s = &samples[i];
+        len = snprintf(line, sizeof(line), "1: %zu [1: %zu] @", s->size, s->size);
+        for (int f = 0; f < s->depth; f++)
+            len += snprintf(line + len, sizeof(line) - len, " 0x%" PRIxPTR,
+                            (uintptr_t)s->frames[f]);
+        line[len++] = '\n';
+        ok = write_all(fd, line, (size_t)len);
+    }
+    free(samples);
+
+#ifdef __linux__
+    ok = ok && write_mappings(fd);
+#endif
+    return ok ? 0 : -1;
+}
+#endif
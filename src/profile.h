@@ -0,0 +1,67 @@
+//*****************************************************************************
+// talloc
+//
+// File:   profile.h
+// Author: Martin Dorazil
+// Date:   19/10/2026
+//
+// Copyright 2017 Martin Dorazil
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#ifndef PROFILE_H_M3KQ8ZWA
+#define PROFILE_H_M3KQ8ZWA
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "utils.h"
+
+// bytes left until next sample in current thread
+extern THREAD_LOCAL int64_t profile_countdown;
+
+/**
+ * Count allocation of count bytes into sampling interval.
+ * @return True when allocation should be sampled.
+ */
+static inline bool
+profile_tick(size_t count)
+{
+    profile_countdown -= (int64_t)count;
+    return profile_countdown <= 0;
+}
+
+/**
+ * Capture backtrace of the caller and store it with allocation.
+ * @return True when sample was recorded.
+ */
+bool
+profile_sample(void *ptr, size_t count);
+
+/**
+ * Remove sample of freed allocation.
+ */
+void
+profile_retire(void *ptr);
+
+int
+profile_dump(int fd);
+
+#endif /* end of include guard: PROFILE_H_M3KQ8ZWA */
@@ -0,0 +1,336 @@
+//*****************************************************************************
+// talloc
+//
+// File:   region.c
+// Author: Martin Dorazil
+// Date:   19/10/2026
+//
+// Copyright 2017 Martin Dorazil
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+
+#include "region.h"
+#include "types.h"
+#include "utils.h"
+
+#define REGION_MAGIC UINT64_C(0x6e6f69676572746c)
+#define REGION_VERSION 2
+// free blocks of size [2^i, 2^(i+1)) are in bin i
+#define REGION_BINS 48
+#define USED_BIT ((uint64_t)1)
+
+typedef struct region_header {
+    uint64_t magic;
+    uint64_t version;
+    uint64_t size;
+    uint64_t used;
+    // offset of root object, 0 when not set
+    uint64_t root;
+    // offsets of first free block of every bin, 0 for empty bin
+    uint64_t bins[REGION_BINS];
+    tatomic_bool flag;
+} region_header_t;
+
+// boundary tag in front of every block
+typedef struct region_block {
+    // size of previous block in address order, 0 for the first block
+    uint64_t prev_size;
+    // size including tag, lowest bit marks used block
+    uint64_t size;
+} region_block_t;
+
+// links of free block stored behind its tag
+typedef struct region_free {
+    uint64_t next;
+    uint64_t prev;
+} region_free_t;
+
+#define FIRST_BLOCK NEXT_MULT_OF(sizeof(region_header_t), TALLOC_ALIGNMENT)
+#define MIN_BLOCK NEXT_MULT_OF(sizeof(region_block_t) + sizeof(region_free_t), TALLOC_ALIGNMENT)
+#define BLOCK_AT(base, offset) ((region_block_t *)((byte_t *)(base) + (offset)))
+#define FREE_OF(block) ((region_free_t *)((block) + 1))
+#define OFFSET_OF(base, ptr) ((uint64_t)((byte_t *)(ptr) - (byte_t *)(base)))
+#define BLOCK_SIZE(block) ((block)->size & ~USED_BIT)
+
+_Static_assert(sizeof(region_block_t) % TALLOC_ALIGNMENT == 0, "misaligned region block");
+
+static size_t
+bin_index(uint64_t size)
+{
+    size_t index = 0;
+    while (size >>= 1)
+        index++;
+    return index < REGION_BINS ? index : REGION_BINS - 1;
+}
+
+static void
+bin_insert(region_header_t *region, uint64_t offset)
+{
+    region_block_t *block = BLOCK_AT(region, offset);
+    uint64_t *head = &region->bins[bin_index(block->size)];
+    region_free_t *links = FREE_OF(block);
+    links->prev = 0;
+    links->next = *head;
+    if (*head)
+        FREE_OF(BLOCK_AT(region, *head))->prev = offset;
+    *head = offset;
+}
+
+static void
+bin_remove(region_header_t *region, uint64_t offset)
+{
+    region_block_t *block = BLOCK_AT(region, offset);
+    const region_free_t *links = FREE_OF(block);
+    if (links->prev)
+        FREE_OF(BLOCK_AT(region, links->prev))->next = links->next;
+    else
+        region->bins[bin_index(block->size)] = links->next;
+    if (links->next)
+        FREE_OF(BLOCK_AT(region, links->next))->prev = links->prev;
+}
+
+// first fit in the smallest bin which can contain block big enough, any block
+// of higher bin fits
+static uint64_t
+find_block(region_header_t *region, uint64_t size)
+{
+    size_t index = bin_index(size);
+    for (uint64_t offset = region->bins[index]; offset;
+         offset = FREE_OF(BLOCK_AT(region, offset))->next) {
+        if (BLOCK_AT(region, offset)->size >= size)
+            return offset;
+    }
+    for (index++; index < REGION_BINS; index++) {
+        if (region->bins[index])
+            return region->bins[index];
+    }
+    return 0;
+}
+
+// set previous size of block following the block at offset
+static void
+link_next(region_header_t *region, uint64_t offset, uint64_t size)
+{
+    if (offset + size < region->size)
+        BLOCK_AT(region, offset + size)->prev_size = size;
+}
+
+bool
+region_init(void *base, size_t size)
+{
+    size &= ~(size_t)(TALLOC_ALIGNMENT - 1);
+    if (size < FIRST_BLOCK + MIN_BLOCK)
+        return false;
+
+    region_header_t *region = (region_header_t *)base;
+    *region = (const region_header_t){0};
+    region->magic = REGION_MAGIC;
+    region->version = REGION_VERSION;
+    region->size = size;
+
+    region_block_t *block = BLOCK_AT(region, FIRST_BLOCK);
+    block->prev_size = 0;
+    block->size = size - FIRST_BLOCK;
+    bin_insert(region, FIRST_BLOCK);
+    return true;
+}
+
+static bool
+check_blocks(region_header_t *region)
+{
+    // blocks must cover whole region and tags must agree
+    uint64_t offset = FIRST_BLOCK;
+    uint64_t prev_size = 0;
+    uint64_t used = 0;
+    size_t free_count = 0;
+    bool prev_free = false;
+    while (offset < region->size) {
+        const region_block_t *block = BLOCK_AT(region, offset);
+        const uint64_t block_size = BLOCK_SIZE(block);
+        if (block_size < MIN_BLOCK || block_size % TALLOC_ALIGNMENT ||
+            block->prev_size != prev_size || block_size > region->size - offset)
+            return false;
+        const bool is_free = !(block->size & USED_BIT);
+        // neighbouring free blocks are always merged
+        if (is_free && prev_free)
+            return false;
+        if (is_free)
+            free_count++;
+        else
+            used += block_size;
+        prev_free = is_free;
+        prev_size = block_size;
+        offset += block_size;
+    }
+    if (offset != region->size || used != region->used)
+        return false;
+    if (region->root && (region->root < FIRST_BLOCK || region->root >= region->size))
+        return false;
+
+    // every free block is exactly once in its bin
+    for (size_t i = 0; i < REGION_BINS; i++) {
+        uint64_t prev = 0;
+        for (uint64_t current = region->bins[i]; current;
+             current = FREE_OF(BLOCK_AT(region, current))->next) {
+            if (current < FIRST_BLOCK || current >= region->size || current % TALLOC_ALIGNMENT ||
+                !free_count)
+                return false;
+            const region_block_t *block = BLOCK_AT(region, current);
+            if ((block->size & USED_BIT) || bin_index(block->size) != i ||
+                FREE_OF(block)->prev != prev)
+                return false;
+            free_count--;
+            prev = current;
+        }
+    }
+    return free_count == 0;
+}
+
+bool
+region_check(void *base, size_t size)
+{
+    region_header_t *region = (region_header_t *)base;
+    if (size < FIRST_BLOCK + MIN_BLOCK || region->magic != REGION_MAGIC ||
+        region->version != REGION_VERSION || region->size > size)
+        return false;
+    LOCK(region->flag);
+    const bool valid = check_blocks(region);
+    UNLOCK(region->flag);
+    return valid;
+}
+
+bool
+region_open(void *base, size_t size)
+{
+    region_header_t *region = (region_header_t *)base;
+    if (size < FIRST_BLOCK + MIN_BLOCK)
+        return false;
+    // flag can stay set by process which crashed inside allocator
+    tatomic_store(&region->flag, false);
+    return region_check(base, size);
+}
+
+void
+region_set_root(void *base, void *root)
+{
+    region_header_t *region = (region_header_t *)base;
+    LOCK(region->flag);
+    region->root = root ? OFFSET_OF(region, root) : 0;
+    UNLOCK(region->flag);
+}
+
+void *
+region_root(void *base)
+{
+    region_header_t *region = (region_header_t *)base;
+    LOCK(region->flag);
+    const uint64_t root = region->root;
+    UNLOCK(region->flag);
+    return root ? (byte_t *)base + root : NULL;
+}
+
+void *
+region_malloc(void *base, size_t count)
+{
+    region_header_t *region = (region_header_t *)base;
+    // region size never changes, bigger requests would overflow block size
+    if (count > region->size)
+        return NULL;
+    uint64_t size = NEXT_MULT_OF((uint64_t)count + sizeof(region_block_t), TALLOC_ALIGNMENT);
+    if (size < MIN_BLOCK)
+        size = MIN_BLOCK;
+
+    LOCK(region->flag);
+    const uint64_t offset = find_block(region, size);
+    if (!offset) {
+        UNLOCK(region->flag);
+        return NULL;
+    }
+    bin_remove(region, offset);
+    region_block_t *block = BLOCK_AT(region, offset);
+    const uint64_t rem_space = block->size - size;
+    if (rem_space >= MIN_BLOCK) {
+        region_block_t *rest = BLOCK_AT(region, offset + size);
+        rest->prev_size = size;
+        rest->size = rem_space;
+        link_next(region, offset + size, rem_space);
+        bin_insert(region, offset + size);
+    } else {
+        size = block->size;
+    }
+    block->size = size | USED_BIT;
+    region->used += size;
+    UNLOCK(region->flag);
+    return block + 1;
+}
+
+void
+region_free(void *base, void *ptr)
+{
+    if (!ptr)
+        return;
+    region_header_t *region = (region_header_t *)base;
+    region_block_t *block = (region_block_t *)ptr - 1;
+    uint64_t offset = OFFSET_OF(region, block);
+#if TALLOC_MEM_CHECKING
+    if (offset < FIRST_BLOCK || offset >= region->size || !(block->size & USED_BIT)) {
+        ABORT("pointer being freed was not allocated from this region");
+    }
+#endif
+
+    LOCK(region->flag);
+    uint64_t size = BLOCK_SIZE(block);
+    region->used -= size;
+
+    // merge with following block
+    if (offset + size < region->size) {
+        region_block_t *next = BLOCK_AT(region, offset + size);
+        if (!(next->size & USED_BIT)) {
+            bin_remove(region, offset + size);
+            size += next->size;
+        }
+    }
+    // merge with previous block
+    if (block->prev_size) {
+        const uint64_t prev_offset = offset - block->prev_size;
+        region_block_t *prev = BLOCK_AT(region, prev_offset);
+        if (!(prev->size & USED_BIT)) {
+            bin_remove(region, prev_offset);
+            size += prev->size;
+            offset = prev_offset;
+            block = prev;
+        }
+    }
+    block->size = size;
+    link_next(region, offset, size);
+    bin_insert(region, offset);
+    UNLOCK(region->flag);
+}
+
+size_t
+region_used(void *base)
+{
+    region_header_t *region = (region_header_t *)base;
+    LOCK(region->flag);
+    const size_t used = region->used;
+    UNLOCK(region->flag);
+    return used;
+}
@@ -0,0 +1,81 @@
+//*****************************************************************************
+// talloc
+//
+// File:   region.h
+// Author: Martin Dorazil
+// Date:   19/10/2026
+//
+// Copyright 2017 Martin Dorazil
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+
+#ifndef REGION_H_H3KD9VQE
+#define REGION_H_H3KD9VQE
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Heap living completely inside one continuous region of memory. Region can be
+// mapped at different address in every process, so all links are stored as
+// offsets from region start and lock is a flag inside the region.
+
+/**
+ * Format memory as empty region heap.
+ * @return False when region is too small.
+ */
+bool
+region_init(void *base, size_t size);
+
+/**
+ * Validate header and all blocks of region.
+ */
+bool
+region_check(void *base, size_t size);
+
+/**
+ * Validate region mapped again (possibly at different address) by its only
+ * user, lock left by crashed process is released.
+ */
+bool
+region_open(void *base, size_t size);
+
+/**
+ * Store offset of root object in region header, NULL clears root.
+ */
+void
+region_set_root(void *base, void *root);
+
+void *
+region_root(void *base);
+
+void *
+region_malloc(void *base, size_t count);
+
+void
+region_free(void *base, void *ptr);
+
+/**
+ * Bytes of region occupied by allocated blocks including headers.
+ */
+size_t
+region_used(void *base);
+
+#endif /* end of include guard: REGION_H_H3KD9VQE */
@@ -0,0 +1,204 @@
+//*****************************************************************************
+// talloc
+//
+// File:   shared.c
+// Author: Martin Dorazil
+// Date:   19/10/2026
+//
+// Copyright 2017 Martin Dorazil
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+
+#ifdef __linux__
+// memfd_create
+#define _GNU_SOURCE
+#endif
+#include <stdlib.h>
+#include "talloc/talloc.h"
+#include "region.h"
+#include "types.h"
+#include "utils.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct talloc_shared {
+    void *base;
+    size_t size;
+    int fd;
+};
+
+#ifndef _WIN32
+// map region of descriptor, descriptor is owned by returned handle
+static talloc_shared_t *
+map_shared(int fd, size_t size)
+{
+    talloc_shared_t *shared = (talloc_shared_t *)malloc(sizeof(talloc_shared_t));
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (!shared || base == MAP_FAILED) {
+        if (base != MAP_FAILED)
+            munmap(base, size);
+        free(shared);
+        close(fd);
+        return NULL;
+    }
+    shared->base = base;
+    shared->size = size;
+    shared->fd = fd;
+    return shared;
+}
+
+// anonymous object can be shared only by passing its descriptor
+static int
+anonymous_fd(void)
+{
+#ifdef __linux__
+    return memfd_create("talloc", MFD_CLOEXEC);
+#else
+    static tatomic_size counter;
+    char name[64];
+    snprintf(name, sizeof(name), "/talloc-%ld-%zu", (long)getpid(), tatomic_add(&counter, 1));
+    const int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0)
+        shm_unlink(name);
+    return fd;
+#endif
+}
+#endif
+
+talloc_shared_t *
+talloc_shared_create(const char *name, size_t size)
+{
+#ifdef _WIN32
+    (void)name, (void)size;
+    return NULL;
+#else
+    size = NEXT_MULT_OF(size, TALLOC_PAGE_SIZE);
+    const int fd = name ? shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600) : anonymous_fd();
+    if (fd < 0)
+        return NULL;
+    if (ftruncate(fd, (off_t)size)) {
+        close(fd);
+        if (name)
+            shm_unlink(name);
+        return NULL;
+    }
+
+    talloc_shared_t *shared = map_shared(fd, size);
+    if (!shared || !region_init(shared->base, size)) {
+        talloc_shared_close(shared);
+        if (name)
+            shm_unlink(name);
+        return NULL;
+    }
+    return shared;
+#endif
+}
+
+talloc_shared_t *
+talloc_shared_attach(int fd)
+{
+#ifdef _WIN32
+    (void)fd;
+    return NULL;
+#else
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st))
+        return NULL;
+    fd = dup(fd);
+    if (fd < 0)
+        return NULL;
+    talloc_shared_t *shared = map_shared(fd, (size_t)st.st_size);
+    if (shared && !region_check(shared->base, shared->size)) {
+        talloc_shared_close(shared);
+        return NULL;
+    }
+    return shared;
+#endif
+}
+
+talloc_shared_t *
+talloc_shared_open(const char *name)
+{
+#ifdef _WIN32
+    (void)name;
+    return NULL;
+#else
+    const int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+        return NULL;
+    talloc_shared_t *shared = talloc_shared_attach(fd);
+    close(fd);
+    return shared;
+#endif
+}
+
+int
+talloc_shared_fd(talloc_shared_t *shared)
+{
+    return shared->fd;
+}
+
+void
+talloc_shared_close(talloc_shared_t *shared)
+{
+    if (!shared)
+        return;
+#ifndef _WIN32
+    munmap(shared->base, shared->size);
+    close(shared->fd);
+#endif
+    free(shared);
+}
+
+void *
+talloc_shared_malloc(talloc_shared_t *shared, size_t count)
+{
+    if (count == 0)
+        return NULL;
+    return region_malloc(shared->base, count);
+}
+
+void
+talloc_shared_free(talloc_shared_t *shared, void *ptr)
+{
+    region_free(shared->base, ptr);
+}
+
+size_t
+talloc_shared_offset(talloc_shared_t *shared, const void *ptr)
+{
+    ASSERT((const byte_t *)ptr > (byte_t *)shared->base &&
+               (const byte_t *)ptr < (byte_t *)shared->base + shared->size,
+           "pointer is not in shared region");
+    return (size_t)((const byte_t *)ptr - (byte_t *)shared->base);
+}
+
+void *
+talloc_shared_pointer(talloc_shared_t *shared, size_t offset)
+{
+    ASSERT(offset && offset < shared->size, "offset is not in shared region");
+    return (byte_t *)shared->base + offset;
+}
@@ -0,0 +1,213 @@
+//*****************************************************************************
+// talloc
+//
+// File:   snapshot.c
+// Author: Martin Dorazil
+// Date:   19/10/2026
+//
+// Copyright 2017 Martin Dorazil
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#include <stdlib.h>
+#include <string.h>
+#include "talloc/talloc.h"
+#include "heap.h"
+#include "pool.h"
+#include "types.h"
+#include "utils.h"
+
+#define SNAPSHOT_MAGIC "TALSNAP1"
+// extra space for blocks created between counting and copying
+#define SNAPSHOT_SLACK 64
+
+static int
+log2_floor(size_t n)
+{
+    int bit = 0;
+    while (n >>= 1)
+        bit++;
+    return bit;
+}
+
+// copy descriptions using provided copy function, grow buffer until everything fits
+static void *
+copy_all(size_t (*copy)(void *, size_t), size_t elem_size, size_t *count)
+{
+    size_t capacity = copy(NULL, 0) + SNAPSHOT_SLACK;
+    void *buf = NULL;
+    while (true) {
+        void *tmp = realloc(buf, capacity * elem_size);
+        if (!tmp) {
+            free(buf);
+            return NULL;
+        }
+        buf = tmp;
+        const size_t n = copy(buf, capacity);
+        if (n <= capacity) {
+            *count = n;
+            return buf;
+        }
+        capacity = n + SNAPSHOT_SLACK;
+    }
+}
+
+static size_t
+copy_blocks(void *buf, size_t capacity)
+{
+    return heap_copy_blocks(&global_heap, (talloc_block_info_t *)buf, capacity);
+}
+
+static size_t
+copy_slabs(void *buf, size_t capacity)
+{
+#if TALLOC_USE_POOLS
+    return pool_copy_slabs(&global_pool, (talloc_slab_info_t *)buf, capacity);
+#else
+    (void)buf;
+    (void)capacity;
+    return 0;
+#endif
+}
+
+static void
+compute_metrics(talloc_snapshot_t *snapshot)
+{
+    for (size_t i = 0; i < snapshot->block_count; i++) {
+        const talloc_block_info_t *block = &snapshot->blocks[i];
+        if (block->used)
+            continue;
+        snapshot->free_bytes += block->size;
+        if (block->size > snapshot->largest_free)
+            snapshot->largest_free = block->size;
+        snapshot->histogram[log2_floor(block->size)]++;
+    }
+
+    if (snapshot->free_bytes)
+        snapshot->fragmentation =
+            1.0 - (double)snapshot->largest_free / (double)snapshot->free_bytes;
+}
+
+talloc_snapshot_t *
+talloc_snapshot_take(void)
+{
+    talloc_snapshot_t *snapshot = (talloc_snapshot_t *)calloc(1, sizeof(talloc_snapshot_t));
+    if (!snapshot)
+        return NULL;
+
+    snapshot->blocks = (talloc_block_info_t *)copy_all(copy_blocks, sizeof(talloc_block_info_t),
+                                                       &snapshot->block_count);
+    snapshot->slabs = (talloc_slab_info_t *)copy_all(copy_slabs, sizeof(talloc_slab_info_t),
+                                                     &snapshot->slab_count);
+    if (!snapshot->blocks || !snapshot->slabs) {
+        talloc_snapshot_free(snapshot);
+        return NULL;
+    }
+
+    snapshot->allocated = heap_allocated(&global_heap);
+    snapshot->used = heap_used(&global_heap);
+    compute_metrics(snapshot);
+    return snapshot;
+}
+
+void
+talloc_snapshot_free(talloc_snapshot_t *snapshot)
+{
+    if (!snapshot)
+        return;
+    free(snapshot->blocks);
+    free(snapshot->slabs);
+    free(snapshot);
+}
+
+int
+talloc_snapshot_write_json(const talloc_snapshot_t *snapshot, FILE *file)
+{
+    fprintf(file, "{\n");
+    fprintf(file, "  \"allocated\": %zu,\n", snapshot->allocated);
+    fprintf(file, "  \"used\": %zu,\n", snapshot->used);
+    fprintf(file, "  \"free\": %zu,\n", snapshot->free_bytes);
+    fprintf(file, "  \"largest_free\": %zu,\n", snapshot->largest_free);
+    fprintf(file, "  \"fragmentation\": %.6f,\n", snapshot->fragmentation);
+
+    fprintf(file, "  \"histogram\": [");
+    for (size_t i = 0; i < TALLOC_HISTOGRAM_SIZE; i++)
+        fprintf(file, "%s%zu", i ? ", " : "", snapshot->histogram[i]);
+    fprintf(file, "],\n");
+
+    fprintf(file, "  \"blocks\": [");
+    for (size_t i = 0; i < snapshot->block_count; i++) {
+        const talloc_block_info_t *block = &snapshot->blocks[i];
+        fprintf(file, "%s\n    {\"address\": %zu, \"size\": %zu, \"used\": %s}", i ? "," : "",
+                (size_t)block->address, block->size, block->used ? "true" : "false");
+    }
+    fprintf(file, "\n  ],\n");
+
+    fprintf(file, "  \"slabs\": [");
+    for (size_t i = 0; i < snapshot->slab_count; i++) {
+        const talloc_slab_info_t *slab = &snapshot->slabs[i];
+        fprintf(file,
+                "%s\n    {\"address\": %zu, \"cell_size\": %zu, \"cell_count\": %zu, "
+                "\"used_cells\": %zu}",
+                i ? "," : "", (size_t)slab->address, slab->cell_size, slab->cell_count,
+                slab->used_cells);
+    }
+    fprintf(file, "\n  ]\n}\n");
+
+    return ferror(file) ? -1 : 0;
+}
+
+static void
+write_u64(FILE *file, uint64_t value)
+{
+    fwrite(&value, sizeof(value), 1, file);
+}
+
+int
+talloc_snapshot_write_binary(const talloc_snapshot_t *snapshot, FILE *file)
+{
+    fwrite(SNAPSHOT_MAGIC, 1, strlen(SNAPSHOT_MAGIC), file);
+    write_u64(file, snapshot->block_count);
+    write_u64(file, snapshot->slab_count);
+    write_u64(file, snapshot->allocated);
+    write_u64(file, snapshot->used);
+    write_u64(file, snapshot->free_bytes);
+    write_u64(file, snapshot->largest_free);
+    fwrite(&snapshot->fragmentation, sizeof(double), 1, file);
+    for (size_t i = 0; i < TALLOC_HISTOGRAM_SIZE; i++)
+        write_u64(file, snapshot->histogram[i]);
+
+    for (size_t i = 0; i < snapshot->block_count; i++) {
+        const talloc_block_info_t *block = &snapshot->blocks[i];
+        write_u64(file, block->address);
+        write_u64(file, block->size);
+        write_u64(file, (uint64_t)block->used);
+    }
+
+    for (size_t i = 0; i < snapshot->slab_count; i++) {
+        const talloc_slab_info_t *slab = &snapshot->slabs[i];
+        write_u64(file, slab->address);
+        write_u64(file, slab->cell_size);
+        write_u64(file, slab->cell_count);
+        write_u64(file, slab->used_cells);
+    }
+
+    return ferror(file) ? -1 : 0;
+}
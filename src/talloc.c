@@ -26,36 +26,170 @@
 // SOFTWARE.
 //*****************************************************************************
 
+#include <stdlib.h>
 #include <string.h>
 #include "talloc/talloc.h"
+#include "cache.h"
 #include "heap.h"
+#include "latency.h"
+#include "maintenance.h"
+#include "pagemap.h"
 #include "pool.h"
 #include "types.h"
 #include "utils.h"
+#if TALLOC_PROFILING
+#include "profile.h"
+#endif
+#if TALLOC_TRACE
+#include "trace.h"
+#endif
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 typedef struct universal_meta {
-#if TALLOC_MEM_CHECKING
-    uintptr_t check;
-#endif
     size_t size;
 } universal_meta_t;
 
 #define GET_UNI_META_PTR(ptr) (universal_meta_t *)(ptr) - 1;
 
+#if TALLOC_PROFILING
+#define SAMPLE(mem, count)                                                                         \
+    if ((mem) && profile_tick(count) && profile_sample((mem), (count))) {                          \
+        universal_meta_t *sampled = GET_UNI_META_PTR(mem);                                         \
+        sampled->size |= SAMPLED_FLAG;                                                             \
+    }
+#else
+#define SAMPLE(mem, count)
+#endif
+
+#if !TALLOC_TRACE
+#define TRACE(op, ptr, old_ptr, size)
+#endif
+
+#if TALLOC_LATENCY_STATS
+#define LATENCY_BEGIN(start) const uint64_t start = latency_begin(TALLOC_PATH_POOL);
+#define LATENCY_END(op, start) latency_end((op), (start));
+#else
+#define LATENCY_BEGIN(start)
+#define LATENCY_END(op, start)
+#endif
+
+struct talloc_mark {
+    struct talloc_mark *prev;
+    talloc_heap_t *heap;
+    unsigned generation;
+    pool_mark_t *pool;
+};
+
+struct talloc_heap {
+    heap_t *heap;
+    pool_t *pool;
+    // the newest mark
+    talloc_mark_t *marks;
+};
+
+static talloc_pressure_f pressure_f;
+
+// called without any allocator lock held
+static void
+relieve_pressure(size_t limit)
+{
+    if (pressure_f)
+        pressure_f(heap_allocated(&global_heap), limit);
+    cache_reap_all();
+    pool_optimize(&global_pool);
+    heap_purge(&global_heap);
+}
+
+// handle memory pressure after allocation, return true when failed allocation
+// should be tried again
+static bool
+check_pressure(const void *mem)
+{
+    if (!mem) {
+        relieve_pressure(heap_hard_limit(&global_heap));
+        return true;
+    }
+    if (tatomic_load(&heap_pressure) && tatomic_exchange(&heap_pressure, false))
+        relieve_pressure(heap_soft_limit(&global_heap));
+    return false;
+}
+
+static void *
+try_malloc(size_t count)
+{
+#if TALLOC_USE_POOLS
+    if (pool_cell_size(count) <= TALLOC_SMALL_TO)
+        return pool_malloc(&global_pool, count);
+#endif
+    LATENCY_PATH(TALLOC_PATH_HEAP);
+    return heap_malloc(&global_heap, count);
+}
+
+// allocation without profiling and tracing
+static void *
+malloc_impl(size_t count)
+{
+    void *mem = try_malloc(count);
+    if (check_pressure(mem))
+        mem = try_malloc(count);
+    return mem;
+}
+
+static size_t
+usable_size(const void *ptr)
+{
+#if TALLOC_USE_POOLS
+    const universal_meta_t *block = GET_UNI_META_PTR(ptr);
+    if ((block->size & ~SAMPLED_FLAG) <= TALLOC_SMALL_TO)
+        return pool_usable_size(ptr);
+#endif
+    return heap_usable_size(ptr);
+}
+
+static void
+free_impl(void *ptr)
+{
+#if TALLOC_MEM_CHECKING
+    const span_t *span = pagemap_get(ptr);
+    if (!span || span->heap != &global_heap) {
+        ABORT("pointer being freed was not allocated");
+    }
+#endif
+#if TALLOC_USE_POOLS || TALLOC_PROFILING
+    universal_meta_t *block = GET_UNI_META_PTR(ptr);
+#endif
+#if TALLOC_PROFILING
+    if (block->size & SAMPLED_FLAG) {
+        block->size &= ~SAMPLED_FLAG;
+        profile_retire(ptr);
+    }
+#endif
+#if TALLOC_USE_POOLS
+    if (block->size <= TALLOC_SMALL_TO) {
+        pool_free(&global_pool, ptr);
+        return;
+    }
+#endif
+    LATENCY_PATH(TALLOC_PATH_HEAP);
+    heap_free(&global_heap, ptr);
+}
+
 void *
 tmalloc(size_t count)
 {
     if (count == 0)
         return NULL;
 
-#if TALLOC_USE_POOLS
-    if (pool_cell_size(count) <= TALLOC_SMALL_TO)
-        return pool_malloc(count);
-#endif
-    return heap_malloc(count);
+    LATENCY_BEGIN(start);
+    void *mem = malloc_impl(count);
+    LATENCY_END(TALLOC_LATENCY_MALLOC, start);
+    if (!mem)
+        return NULL;
+    SAMPLE(mem, count);
+    TRACE(TALLOC_TRACE_MALLOC, mem, NULL, count);
+    return mem;
 }
 
 void *
@@ -63,18 +197,33 @@ trealloc(void *ptr, size_t size)
 {
     if (!ptr)
         return tmalloc(size);
-    void *mem = tmalloc(size);
-    memcpy(mem, ptr, size);
-    tfree(ptr);
+    LATENCY_BEGIN(start);
+    void *mem = size ? malloc_impl(size) : NULL;
+    // original block stays valid when allocation failed
+    if (size && !mem) {
+        LATENCY_END(TALLOC_LATENCY_REALLOC, start);
+        return NULL;
+    }
+    if (mem) {
+        SAMPLE(mem, size);
+        const size_t old_size = usable_size(ptr);
+        memcpy(mem, ptr, size < old_size ? size : old_size);
+    }
+    TRACE(TALLOC_TRACE_REALLOC, mem, ptr, size);
+    free_impl(ptr);
+    LATENCY_END(TALLOC_LATENCY_REALLOC, start);
     return mem;
 }
 
 void *
 tcalloc(const size_t nelem, const size_t elsize)
 {
+    if (elsize && nelem > SIZE_MAX / elsize)
+        return NULL;
     const size_t size = nelem * elsize;
     void *mem = tmalloc(size);
-    memset(mem, 0, size);
+    if (mem)
+        memset(mem, 0, size);
     return mem;
 }
 
@@ -83,59 +232,357 @@ tfree(void *ptr)
 {
     if (!ptr)
         return;
+    TRACE(TALLOC_TRACE_FREE, ptr, NULL, 0);
+    LATENCY_BEGIN(start);
+    free_impl(ptr);
+    LATENCY_END(TALLOC_LATENCY_FREE, start);
+}
+
+#define CLASS_USABLE_SIZE(c) (((c) + 1) * TALLOC_POOL_GROUP_MULT - TALLOC_HEADER_SIZE)
+
+void *
+talloc_class_malloc(size_t size_class)
+{
 #if TALLOC_USE_POOLS
-    const universal_meta_t *block = GET_UNI_META_PTR(ptr);
+    void *mem = pool_class_malloc(&global_pool, size_class);
+    if (check_pressure(mem))
+        mem = pool_class_malloc(&global_pool, size_class);
+    if (!mem)
+        return NULL;
+    SAMPLE(mem, CLASS_USABLE_SIZE(size_class));
+    TRACE(TALLOC_TRACE_MALLOC, mem, NULL, CLASS_USABLE_SIZE(size_class));
+    return mem;
+#else
+    return tmalloc(CLASS_USABLE_SIZE(size_class));
+#endif
+}
 
+void
+talloc_class_free(void *ptr, size_t size_class)
+{
+#if TALLOC_USE_POOLS
+    if (!ptr)
+        return;
+    TRACE(TALLOC_TRACE_FREE, ptr, NULL, 0);
 #if TALLOC_MEM_CHECKING
-    if (block->check != (uintptr_t)ptr) {
+    const span_t *span = pagemap_get(ptr);
+    if (!span || span->heap != &global_heap) {
         ABORT("pointer being freed was not allocated");
     }
 #endif
-    if (block->size <= TALLOC_SMALL_TO) {
-        pool_free(ptr);
-        return;
+#if TALLOC_PROFILING
+    universal_meta_t *block = GET_UNI_META_PTR(ptr);
+    if (block->size & SAMPLED_FLAG) {
+        block->size &= ~SAMPLED_FLAG;
+        profile_retire(ptr);
     }
 #endif
-    heap_free(ptr);
+    pool_class_free(&global_pool, ptr, size_class);
+#else
+    (void)size_class;
+    tfree(ptr);
+#endif
+}
+
+bool
+talloc_owns(const void *ptr)
+{
+    return ptr && pagemap_get(ptr);
+}
+
+size_t
+talloc_usable_size(const void *ptr)
+{
+    if (!talloc_owns(ptr))
+        return 0;
+    return usable_size(ptr);
 }
 
 void
 talloc_expand(size_t count)
 {
-    heap_expand(count);
+    heap_expand(&global_heap, count);
+}
+
+bool
+talloc_reserve(size_t size, size_t count)
+{
+    const talloc_reservation_t entry = {size, count};
+    return talloc_reserve_profile(&entry, 1);
+}
+
+bool
+talloc_reserve_profile(const talloc_reservation_t *profile, size_t count)
+{
+    size_t heap_bytes = 0;
+    for (size_t i = 0; i < count; i++) {
+        const size_t size = profile[i].size;
+        if (!size || !profile[i].count)
+            continue;
+#if TALLOC_USE_POOLS
+        if (pool_cell_size(size) <= TALLOC_SMALL_TO) {
+            if (!pool_reserve(&global_pool, size, profile[i].count))
+                return false;
+            continue;
+        }
+#endif
+#if TALLOC_HUGE_SIZE
+        // huge chunks are mapped on demand and never come from heap space
+        if (size >= TALLOC_HUGE_SIZE)
+            continue;
+#endif
+        const size_t block = heap_block_size(size);
+        if (profile[i].count > (SIZE_MAX - heap_bytes) / block)
+            return false;
+        heap_bytes += block * profile[i].count;
+    }
+    return !heap_bytes || heap_reserve(&global_heap, heap_bytes);
 }
 
 void
 talloc_print_blocks(FILE *file)
 {
-    heap_print_blocks(file);
+    heap_print_blocks(&global_heap, file);
 }
 
 void
 talloc_optimize()
 {
 #if TALLOC_USE_POOLS
-    pool_optimize();
+    pool_optimize(&global_pool);
 #endif
 }
 
 size_t
 talloc_allocated()
 {
-    return heap_allocated();
+    return heap_allocated(&global_heap);
 }
 
 size_t
 talloc_used()
 {
-    return heap_used();
+    return heap_used(&global_heap);
+}
+
+void
+talloc_set_limits(size_t soft, size_t hard)
+{
+    heap_set_limits(&global_heap, soft, hard);
+}
+
+size_t
+talloc_get_soft_limit(void)
+{
+    return heap_soft_limit(&global_heap);
 }
 
+size_t
+talloc_get_hard_limit(void)
+{
+    return heap_hard_limit(&global_heap);
+}
+
+void
+talloc_set_pressure_func(talloc_pressure_f func)
+{
+    pressure_f = func;
+}
+
+void
+talloc_purge(void)
+{
+    cache_reap_all();
+    pool_optimize(&global_pool);
+    heap_purge(&global_heap);
+}
+
+bool
+talloc_maintenance_start(unsigned interval_ms)
+{
+    return maintenance_start(interval_ms);
+}
+
+void
+talloc_maintenance_stop(void)
+{
+    maintenance_stop();
+}
+
+void
+talloc_get_maintenance_stats(talloc_maintenance_stats_t *stats)
+{
+    maintenance_stats(stats);
+}
+
+void
+talloc_set_heap_policy(talloc_policy_t policy)
+{
+    heap_set_policy(&global_heap, policy);
+}
+
+void
+talloc_get_heap_stats(talloc_heap_stats_t *stats)
+{
+    heap_get_stats(&global_heap, stats);
+}
+
+void
+talloc_reset_heap_stats(void)
+{
+    heap_reset_stats(&global_heap);
+}
+
+talloc_heap_t *
+talloc_heap_create(void)
+{
+    talloc_heap_t *heap = (talloc_heap_t *)malloc(sizeof(talloc_heap_t));
+    if (!heap)
+        return NULL;
+    heap->heap = heap_create();
+    heap->pool = heap->heap ? pool_create(heap->heap) : NULL;
+    heap->marks = NULL;
+    if (!heap->pool) {
+        if (heap->heap)
+            heap_destroy(heap->heap);
+        free(heap);
+        return NULL;
+    }
+    return heap;
+}
+
+void
+talloc_heap_destroy(talloc_heap_t *heap)
+{
+    if (!heap)
+        return;
+    while (heap->marks) {
+        talloc_mark_t *mark = heap->marks;
+        heap->marks = mark->prev;
+        pool_drop_mark(heap->pool, mark->pool);
+        free(mark);
+    }
+    pool_destroy(heap->pool);
+    heap_destroy(heap->heap);
+    free(heap);
+}
+
+void *
+talloc_heap_malloc(talloc_heap_t *heap, size_t count)
+{
+    if (count == 0)
+        return NULL;
+#if TALLOC_USE_POOLS
+    if (pool_cell_size(count) <= TALLOC_SMALL_TO)
+        return pool_malloc(heap->pool, count);
+#endif
+    return heap_malloc(heap->heap, count);
+}
+
+void
+talloc_heap_free(talloc_heap_t *heap, void *ptr)
+{
+    if (!ptr)
+        return;
+#if TALLOC_MEM_CHECKING
+    const span_t *span = pagemap_get(ptr);
+    if (!span || span->heap != heap->heap) {
+        ABORT("pointer being freed was not allocated from this heap");
+    }
+#endif
+#if TALLOC_USE_POOLS
+    const universal_meta_t *block = GET_UNI_META_PTR(ptr);
+    if (block->size <= TALLOC_SMALL_TO) {
+        pool_free(heap->pool, ptr);
+        return;
+    }
+#endif
+    heap_free(heap->heap, ptr);
+}
+
+void
+talloc_heap_set_policy(talloc_heap_t *heap, talloc_policy_t policy)
+{
+    heap_set_policy(heap->heap, policy);
+}
+
+void
+talloc_heap_get_stats(talloc_heap_t *heap, talloc_heap_stats_t *stats)
+{
+    heap_get_stats(heap->heap, stats);
+}
+
+talloc_mark_t *
+talloc_mark(talloc_heap_t *heap)
+{
+    talloc_mark_t *mark = (talloc_mark_t *)malloc(sizeof(talloc_mark_t));
+    if (!mark)
+        return NULL;
+    mark->pool = pool_mark(heap->pool);
+    if (!mark->pool) {
+        free(mark);
+        return NULL;
+    }
+    mark->generation = heap_mark(heap->heap);
+    mark->heap = heap;
+    mark->prev = heap->marks;
+    heap->marks = mark;
+    return mark;
+}
+
+void
+talloc_rewind(talloc_mark_t *mark)
+{
+    talloc_heap_t *heap = mark->heap;
+    // newer marks are discarded together with their allocations
+    while (heap->marks != mark) {
+        talloc_mark_t *newer = heap->marks;
+        if (!newer) {
+            ABORT("mark was already released");
+        }
+        heap->marks = newer->prev;
+        pool_drop_mark(heap->pool, newer->pool);
+        free(newer);
+    }
+    heap->marks = mark->prev;
+    pool_rewind(heap->pool, mark->pool);
+    heap_rewind(heap->heap, mark->generation);
+    free(mark);
+}
+
+#if TALLOC_PROFILING
+int
+talloc_profile_dump(int fd)
+{
+    return profile_dump(fd);
+}
+#endif
+
+#if TALLOC_TRACE
+int
+talloc_trace_start(const char *path)
+{
+    return trace_start(path);
+}
+
+void
+talloc_trace_flush(void)
+{
+    trace_flush();
+}
+
+void
+talloc_trace_stop(void)
+{
+    trace_stop();
+}
+#endif
+
 #if TALLOC_FORCE_RESET
 void
 talloc_force_reset()
 {
-    heap_force_reset();
+    heap_force_reset(&global_heap);
 }
 #endif
 
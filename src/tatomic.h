@@ -29,19 +29,50 @@
 #ifndef TATOMIC_H_7PDCBQAZ
 #define TATOMIC_H_7PDCBQAZ
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
 #ifdef _MSC_VER
 #include <Windows.h>
 #define tatomic_exchange(ex, val) InterlockedExchange((LONG *)(ex), (val))
 #define tatomic_store(st, val) ((*st) = (val))
-#define tatomic_load(l) atomic_load((l)) * (l)
+#define tatomic_load(l) (*(l))
+#define tatomic_store_relaxed(st, val) ((*st) = (val))
+#define tatomic_load_relaxed(l) (*(l))
+#define tatomic_add(obj, val) InterlockedExchangeAdd64((volatile LONG64 *)(obj), (LONG64)(val))
+#define tatomic_sub(obj, val) InterlockedExchangeAdd64((volatile LONG64 *)(obj), -(LONG64)(val))
 
 typedef volatile bool tatomic_bool;
+typedef void *volatile tatomic_ptr;
+typedef volatile size_t tatomic_size;
+typedef volatile LONG64 tatomic_u64;
+
+// on failure expected is updated to current value
+static __inline bool
+tatomic_cas(tatomic_u64 *obj, uint64_t *expected, uint64_t desired)
+{
+    const LONG64 prev = InterlockedCompareExchange64(obj, (LONG64)desired, (LONG64)*expected);
+    if (prev == (LONG64)*expected)
+        return true;
+    *expected = (uint64_t)prev;
+    return false;
+}
 #else
 #include <stdatomic.h>
 #define tatomic_exchange(ex, val) atomic_exchange((ex), (val))
 #define tatomic_store(st, val) atomic_store((st), (val))
 #define tatomic_load(l) atomic_load((l))
+#define tatomic_store_relaxed(st, val) atomic_store_explicit((st), (val), memory_order_relaxed)
+#define tatomic_load_relaxed(l) atomic_load_explicit((l), memory_order_relaxed)
+#define tatomic_add(obj, val) atomic_fetch_add((obj), (val))
+#define tatomic_sub(obj, val) atomic_fetch_sub((obj), (val))
+// on failure expected is updated to current value
+#define tatomic_cas(obj, expected, desired) atomic_compare_exchange_weak((obj), (expected), (desired))
 
 typedef atomic_bool tatomic_bool;
+typedef _Atomic(void *) tatomic_ptr;
+typedef atomic_size_t tatomic_size;
+typedef _Atomic(uint64_t) tatomic_u64;
 #endif
 #endif /* end of include guard: TATOMIC_H_7PDCBQAZ */
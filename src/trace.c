@@ -0,0 +1,187 @@
+//*****************************************************************************
+// talloc
+//
+// File:   trace.c
+// Author: Martin Dorazil
+// Date:   19/10/2026
+//
+// Copyright 2017 Martin Dorazil
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#include "talloc/talloc_config.h"
+#if TALLOC_TRACE
+#include <stdio.h>
+#include <string.h>
+#include "trace.h"
+#include "types.h"
+
+#ifdef _MSC_VER
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+
+typedef struct trace_buffer {
+    uint32_t thread;
+    uint32_t session;
+    size_t count;
+    talloc_trace_record_t records[TALLOC_TRACE_BUFFER_SIZE];
+} trace_buffer_t;
+
+tatomic_bool trace_enabled;
+static tatomic_bool trace_flag;
+static FILE *trace_file;
+static uint32_t session;
+static uint32_t thread_count;
+static THREAD_LOCAL trace_buffer_t *buffer;
+
+#ifndef _MSC_VER
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t buffer_key;
+#endif
+
+static uint64_t
+now(void)
+{
+#ifdef _MSC_VER
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (uint64_t)(counter.QuadPart / frequency.QuadPart * 1000000000ull +
+                      counter.QuadPart % frequency.QuadPart * 1000000000ull / frequency.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static void
+flush_buffer(trace_buffer_t *buf)
+{
+    LOCK(trace_flag);
+    // records of previous trace session are dropped
+    if (trace_file && buf->session == session)
+        fwrite(buf->records, sizeof(talloc_trace_record_t), buf->count, trace_file);
+    buf->count = 0;
+    buf->session = session;
+    UNLOCK(trace_flag);
+}
+
+#ifndef _MSC_VER
+static void
+release_buffer(void *buf)
+{
+    flush_buffer((trace_buffer_t *)buf);
+    free(buf);
+}
+
+static void
+create_key(void)
+{
+    pthread_key_create(&buffer_key, release_buffer);
+}
+#endif
+
+static trace_buffer_t *
+create_buffer(void)
+{
+    // buffers live in system memory so recording never recurse into talloc
+    trace_buffer_t *buf = (trace_buffer_t *)malloc(sizeof(trace_buffer_t));
+    if (!buf)
+        return NULL;
+
+    LOCK(trace_flag);
+    buf->thread = ++thread_count;
+    buf->session = session;
+    UNLOCK(trace_flag);
+    buf->count = 0;
+
+#ifndef _MSC_VER
+    // buffer is flushed on thread exit
+    pthread_once(&key_once, create_key);
+    pthread_setspecific(buffer_key, buf);
+#endif
+    buffer = buf;
+    return buf;
+}
+
+void
+trace_record(talloc_trace_op_t op, const void *ptr, const void *old_ptr, size_t size)
+{
+    trace_buffer_t *buf = buffer;
+    if (!buf && !(buf = create_buffer()))
+        return;
+    if (buf->count == TALLOC_TRACE_BUFFER_SIZE)
+        flush_buffer(buf);
+
+    talloc_trace_record_t *record = &buf->records[buf->count++];
+    record->time = now();
+    record->id = (uint64_t)(uintptr_t)ptr;
+    record->old_id = (uint64_t)(uintptr_t)old_ptr;
+    record->size = size;
+    record->thread = buf->thread;
+    record->op = op;
+}
+
+int
+trace_start(const char *path)
+{
+    FILE *file = fopen(path, "wb");
+    if (!file)
+        return -1;
+
+    const uint32_t header[2] = {TALLOC_TRACE_VERSION, sizeof(talloc_trace_record_t)};
+    fwrite(TALLOC_TRACE_MAGIC, 1, strlen(TALLOC_TRACE_MAGIC), file);
+    fwrite(header, sizeof(header), 1, file);
+
+    LOCK(trace_flag);
+    if (trace_file)
+        fclose(trace_file);
+    trace_file = file;
+    session++;
+    UNLOCK(trace_flag);
+
+    tatomic_store(&trace_enabled, true);
+    return 0;
+}
+
+void
+trace_flush(void)
+{
+    if (buffer)
+        flush_buffer(buffer);
+}
+
+void
+trace_stop(void)
+{
+    tatomic_store(&trace_enabled, false);
+    trace_flush();
+
+    LOCK(trace_flag);
+    if (trace_file)
+        fclose(trace_file);
+    trace_file = NULL;
+    UNLOCK(trace_flag);
+}
+#endif
@@ -0,0 +1,59 @@
+//*****************************************************************************
+// talloc
+//
+// File:   trace.h
+// Author: Martin Dorazil
+// Date:   19/10/2026
+//
+// Copyright 2017 Martin Dorazil
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#ifndef TRACE_H_H4TQ0VXE
+#define TRACE_H_H4TQ0VXE
+
+#include <stddef.h>
+#include "utils.h"
+
+extern tatomic_bool trace_enabled;
+
+/**
+ * Append record into trace buffer of current thread. Allocations must be
+ * recorded after the allocator returns and frees before memory is released,
+ * so recorded order is always valid for replay.
+ */
+void
+trace_record(talloc_trace_op_t op, const void *ptr, const void *old_ptr, size_t size);
+
+int
+trace_start(const char *path);
+
+void
+trace_flush(void);
+
+void
+trace_stop(void);
+
+#define TRACE(op, ptr, old_ptr, size)                                                              \
+    if (tatomic_load(&trace_enabled)) {                                                            \
+        trace_record((op), (ptr), (old_ptr), (size));                                              \
+    }
+
+#endif /* end of include guard: TRACE_H_H4TQ0VXE */
@@ -33,6 +33,7 @@
 #include <assert.h>
 #include <stdbool.h>
 #include "tatomic.h"
+#include "probes.h"
 #include "talloc/talloc.h"
 
 extern talloc_err_f err_f;
@@ -45,10 +46,23 @@ extern talloc_err_f err_f;
 
 #define ASSERT(exp, msg) assert((exp) && (msg))
 
+#if PROBES_ENABLED
+// contended lock fires probe with count of spins
+#define LOCK(flag)                                                                                 \
+    do {                                                                                           \
+        if (tatomic_exchange(&(flag), true)) {                                                     \
+            size_t spins = 1;                                                                      \
+            while (tatomic_exchange(&(flag), true))                                                \
+                spins++;                                                                           \
+            PROBE2(lock_contended, (void *)&(flag), spins);                                        \
+        }                                                                                          \
+    } while (0)
+#else
 #define LOCK(flag)                                                                                 \
     while (tatomic_exchange(&(flag), true)) {                                                      \
         ;                                                                                          \
     }
+#endif
 #define UNLOCK(flag) tatomic_store(&(flag), false)
 #define TRY_LOCK(flag) !tatomic_exchange(&(flag), true)
 #define WAIT_LOCK(flag)                                                                            \
@@ -56,6 +70,17 @@ extern talloc_err_f err_f;
         ;                                                                                          \
     }
 
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#define ALIGNED(n) __declspec(align(n))
+#else
+#define THREAD_LOCAL _Thread_local
+#define ALIGNED(n) _Alignas(n)
+#endif
+
+// sizes are always aligned so lowest bit of size can mark sampled allocations
+#define SAMPLED_FLAG ((size_t)1)
+
 #define NEXT_MULT_OF(n, mult) ((n) + (mult)-1 - ((n)-1) % (mult))
 
 #endif /* end of include guard: UTILS_H_LRSUGIAD */
@@ -0,0 +1,106 @@
+//*****************************************************************************
+// talloc
+//
+// File:   talloc_hpp_test.cpp
+// Author: Martin Dorazil
+// Date:   19/10/2026
+//
+// Copyright 2017 Martin Dorazil
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include "talloc/talloc.hpp"
+
+#define CHECK(expr)                                                                                \
+    do {                                                                                           \
+        if (!(expr)) {                                                                             \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr);         \
+            return false;                                                                          \
+        }                                                                                          \
+    } while (0)
+
+static int live = 0;
+
+struct node {
+    explicit node(int v) : value(v), next(nullptr) { live++; }
+    ~node() { live--; }
+    int value;
+    node *next;
+};
+
+struct big {
+    explicit big(int v) : value(v) { std::memset(data, v, sizeof(data)); live++; }
+    ~big() { live--; }
+    int value;
+    char data[TALLOC_SMALL_TO * 2];
+};
+
+struct alignas(16) vec4 {
+    explicit vec4(int v) : value(v) { live++; }
+    ~vec4() { live--; }
+    int value;
+    float data[3];
+};
+
+// create, check alignment and contents, destroy in reverse order
+template <typename T>
+static bool
+round_trip()
+{
+    T *objects[500];
+    for (int i = 0; i < 500; i++) {
+        objects[i] = talloc::object_pool<T>::create(i);
+        CHECK(objects[i]);
+        CHECK(reinterpret_cast<std::uintptr_t>(objects[i]) % alignof(T) == 0);
+    }
+    for (int i = 0; i < 500; i++)
+        CHECK(objects[i]->value == i);
+    for (int i = 499; i >= 0; i--)
+        talloc::object_pool<T>::destroy(objects[i]);
+    CHECK(live == 0);
+
+    // raw memory without construction
+    T *raw = talloc::object_pool<T>::allocate();
+    talloc::object_pool<T>::deallocate(raw);
+    talloc::unique_ptr<T> owned = talloc::make<T>(7);
+    CHECK(owned->value == 7);
+    CHECK(reinterpret_cast<std::uintptr_t>(owned.get()) % alignof(T) == 0);
+    owned.reset();
+    CHECK(live == 0);
+    return true;
+}
+
+int
+main()
+{
+#if TALLOC_USE_POOLS
+    static_assert(talloc::object_pool<node>::pooled, "node should be pooled");
+    static_assert(talloc::object_pool<vec4>::pooled, "vec4 should be pooled");
+#endif
+    static_assert(!talloc::object_pool<big>::pooled, "big should not be pooled");
+    talloc::object_pool<node>::destroy(nullptr);
+
+    const bool ok = round_trip<node>() && round_trip<big>() && round_trip<vec4>();
+    std::printf("%s\n", ok ? "PASS talloc_hpp_test" : "FAIL talloc_hpp_test");
+    return ok ? 0 : 1;
+}
@@ -27,7 +27,17 @@
 //*****************************************************************************
 
 #include <check.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/wait.h>
+#endif
 #include "talloc/talloc.h"
+#include "talloc/talloc_inline.h"
 
 // maximum size for 512 will be 4104 bytes (we test also large allocations)
 #define TEST_SIZES_COUNT 512 
@@ -58,6 +68,1049 @@ START_TEST(test_allocation)
         tfree(test_data_ptrs[i]);
         test_data_ptrs[i] = NULL;
     }
+    // realloc to zero bytes frees block
+    ck_assert_ptr_null(trealloc(tmalloc(64), 0));
+
+    // pool cells are aligned like heap blocks
+    for (size_t size = 1; size <= TALLOC_SMALL_TO; size += 7) {
+        void *ptr = tmalloc(size);
+        ck_assert_uint_eq((uintptr_t)ptr % TALLOC_ALIGNMENT, 0);
+        tfree(ptr);
+    }
+}
+END_TEST
+
+#define THREAD_COUNT 8
+
+static void *
+thread_allocation(void *arg)
+{
+    void *ptrs[TEST_BUFFER_SIZE] = {0};
+    const intptr_t seed = (intptr_t)arg;
+    for (int i = 0; i < TEST_COUNT; i++) {
+        const int buf_id = buffer_id(i * 7 + seed);
+        if (ptrs[buf_id]) {
+            ck_assert_uint_eq(*(intptr_t *)ptrs[buf_id], (intptr_t)ptrs[buf_id]);
+            tfree(ptrs[buf_id]);
+        }
+        ptrs[buf_id] = tmalloc(test_size_for_id(buf_id + seed));
+        *(intptr_t *)ptrs[buf_id] = (intptr_t)ptrs[buf_id];
+    }
+
+    for (int i = 0; i < TEST_BUFFER_SIZE; i++)
+        tfree(ptrs[i]);
+    return NULL;
+}
+
+START_TEST(test_threads)
+{
+    pthread_t threads[THREAD_COUNT];
+    for (intptr_t i = 0; i < THREAD_COUNT; i++)
+        pthread_create(&threads[i], NULL, thread_allocation, (void *)i);
+    for (int i = 0; i < THREAD_COUNT; i++)
+        pthread_join(threads[i], NULL);
+}
+END_TEST
+
+static void *volatile shared_ptrs[TEST_BUFFER_SIZE];
+
+// memory is freed by another thread than the one which allocated it
+static void *
+thread_exchange(void *arg)
+{
+    const intptr_t seed = (intptr_t)arg;
+    for (int i = 0; i < TEST_COUNT; i++) {
+        const int buf_id = buffer_id(i * 13 + seed);
+        const size_t size = test_size_for_id(buf_id + seed) % TALLOC_SMALL_TO + 1;
+        void *ptr = tmalloc(size);
+        memset(ptr, 0xab, size);
+        void *old = __atomic_exchange_n(&shared_ptrs[buf_id], ptr, __ATOMIC_ACQ_REL);
+        tfree(old);
+    }
+    return NULL;
+}
+
+START_TEST(test_threads_exchange)
+{
+    pthread_t threads[THREAD_COUNT];
+    for (intptr_t i = 0; i < THREAD_COUNT; i++)
+        pthread_create(&threads[i], NULL, thread_exchange, (void *)i);
+    for (int i = 0; i < THREAD_COUNT; i++)
+        pthread_join(threads[i], NULL);
+    for (int i = 0; i < TEST_BUFFER_SIZE; i++)
+        tfree(shared_ptrs[i]);
+    talloc_optimize();
+#if TALLOC_USE_POOLS
+    // all slabs are released
+    talloc_snapshot_t *snapshot = talloc_snapshot_take();
+    ck_assert_uint_eq(snapshot->slab_count, 0);
+    talloc_snapshot_free(snapshot);
+#endif
+}
+END_TEST
+
+#if TALLOC_USE_POOLS
+static int optimize_stop;
+
+static void *
+thread_optimize(void *arg)
+{
+    (void)arg;
+    while (!__atomic_load_n(&optimize_stop, __ATOMIC_ACQUIRE))
+        talloc_optimize();
+    return NULL;
+}
+
+// short lived threads drain pool to zero used cells while slabs are released
+static void *
+thread_burst(void *arg)
+{
+    const size_t size = 16 + (size_t)(intptr_t)arg % 4 * 24;
+    unsigned char *cells[32];
+    for (int round = 0; round < 200; round++) {
+        for (int i = 0; i < 32; i++) {
+            cells[i] = (unsigned char *)tmalloc(size);
+            ck_assert_ptr_nonnull(cells[i]);
+            memset(cells[i], i, size);
+        }
+        for (int i = 0; i < 32; i++) {
+            ck_assert_uint_eq(cells[i][0], i);
+            ck_assert_uint_eq(cells[i][size - 1], i);
+            tfree(cells[i]);
+        }
+    }
+    return NULL;
+}
+
+START_TEST(test_optimize_race)
+{
+    pthread_t optimizer;
+    __atomic_store_n(&optimize_stop, 0, __ATOMIC_RELEASE);
+    pthread_create(&optimizer, NULL, thread_optimize, NULL);
+    for (intptr_t wave = 0; wave < 16; wave++) {
+        pthread_t threads[4];
+        for (intptr_t i = 0; i < 4; i++)
+            pthread_create(&threads[i], NULL, thread_burst, (void *)(wave * 4 + i));
+        for (int i = 0; i < 4; i++)
+            pthread_join(threads[i], NULL);
+    }
+    __atomic_store_n(&optimize_stop, 1, __ATOMIC_RELEASE);
+    pthread_join(optimizer, NULL);
+}
+END_TEST
+#endif
+
+START_TEST(test_ownership)
+{
+    int local = 0;
+    void *foreign = malloc(64);
+    void *small = tmalloc(40);
+    void *large = tmalloc(100000);
+
+    ck_assert(talloc_owns(small));
+    ck_assert(talloc_owns(large));
+    ck_assert(!talloc_owns(&local));
+    ck_assert(!talloc_owns(foreign));
+    ck_assert(!talloc_owns(NULL));
+
+    ck_assert_uint_ge(talloc_usable_size(small), 40);
+#if TALLOC_USE_POOLS
+    ck_assert_uint_lt(talloc_usable_size(small), 40 + TALLOC_POOL_GROUP_MULT);
+#endif
+    ck_assert_uint_ge(talloc_usable_size(large), 100000);
+    ck_assert_uint_eq(talloc_usable_size(foreign), 0);
+
+    free(foreign);
+    tfree(small);
+    tfree(large);
+}
+END_TEST
+
+#if TALLOC_HEAP_QUICK_BINS
+START_TEST(test_heap_quick_reuse)
+{
+    void *ptrs[8];
+    for (int i = 0; i < 8; i++)
+        ptrs[i] = tmalloc(100000);
+    tfree(ptrs[2]);
+    tfree(ptrs[5]);
+
+    // same size blocks are handed back without coalescing
+    void *a = tmalloc(100000);
+    void *b = tmalloc(100000);
+    ck_assert_ptr_eq(a, ptrs[5]);
+    ck_assert_ptr_eq(b, ptrs[2]);
+    ptrs[2] = b;
+    ptrs[5] = a;
+
+    for (int i = 0; i < 8; i++)
+        tfree(ptrs[i]);
+    talloc_optimize();
+
+    // heap is consistent after parked blocks are coalesced
+    void *huge = tmalloc(8 * 100000);
+    talloc_snapshot_t *snapshot = talloc_snapshot_take();
+    size_t total = 0;
+    for (size_t i = 0; i < snapshot->block_count; i++)
+        total += snapshot->blocks[i].size;
+    ck_assert_uint_eq(total, snapshot->allocated);
+    talloc_snapshot_free(snapshot);
+    tfree(huge);
+}
+END_TEST
+#endif
+
+START_TEST(test_size_class)
+{
+    ck_assert(TALLOC_CLASS_POOLED(100) == TALLOC_USE_POOLS);
+    ck_assert(!TALLOC_CLASS_POOLED(TALLOC_SMALL_TO));
+    void *ptrs[256];
+    for (int i = 0; i < 256; i++) {
+        ptrs[i] = talloc_class_malloc(TALLOC_SIZE_CLASS(100));
+        ck_assert_uint_ge(talloc_usable_size(ptrs[i]), 100);
+        memset(ptrs[i], i, 100);
+    }
+#if TALLOC_USE_POOLS
+    // class cells are interchangeable with tmalloc of the same size
+    void *ptr = tmalloc(100);
+    ck_assert_uint_eq(talloc_usable_size(ptr), talloc_usable_size(ptrs[0]));
+    talloc_class_free(ptr, TALLOC_SIZE_CLASS(100));
+#endif
+    for (int i = 0; i < 256; i++)
+        talloc_class_free(ptrs[i], TALLOC_SIZE_CLASS(100));
+    talloc_class_free(NULL, 0);
+}
+END_TEST
+
+START_TEST(test_inline_fast_path)
+{
+    void *ptrs[256];
+    for (int i = 0; i < 256; i++) {
+        ptrs[i] = talloc_inline_malloc(48);
+        memset(ptrs[i], i, 48);
+        ck_assert(talloc_owns(ptrs[i]));
+    }
+    for (int i = 0; i < 256; i++)
+        talloc_inline_free(ptrs[i]);
+
+#if TALLOC_INLINE_FAST_PATH
+    // thread cache is LIFO
+    void *ptr = talloc_inline_malloc(48);
+    ck_assert_ptr_eq(ptr, ptrs[255]);
+    talloc_inline_free(ptr);
+#endif
+
+    // big blocks take slow path
+    void *big = talloc_inline_malloc(TALLOC_SMALL_TO * 4);
+    ck_assert_uint_ge(talloc_usable_size(big), TALLOC_SMALL_TO * 4);
+    talloc_inline_free(big);
+    talloc_inline_free(NULL);
+}
+END_TEST
+
+START_TEST(test_heap_policies)
+{
+    static const talloc_policy_t policies[] = {TALLOC_POLICY_FIRST_FIT, TALLOC_POLICY_NEXT_FIT,
+                                               TALLOC_POLICY_BEST_FIT};
+    for (size_t p = 0; p < sizeof(policies) / sizeof(policies[0]); p++) {
+        talloc_set_heap_policy(policies[p]);
+        talloc_reset_heap_stats();
+
+        unsigned char *ptrs[64];
+        for (int i = 0; i < 64; i++) {
+            ptrs[i] = tmalloc(3000 + i * 517);
+            memset(ptrs[i], i, 3000);
+        }
+        // free every other block and fill holes with different sizes
+        for (int i = 0; i < 64; i += 2)
+            tfree(ptrs[i]);
+        for (int i = 0; i < 64; i += 2) {
+            ptrs[i] = tmalloc(2500 + i * 131);
+            memset(ptrs[i], i, 2500);
+        }
+        for (int i = 0; i < 64; i++) {
+            ck_assert_uint_eq(ptrs[i][0], i);
+            ck_assert_uint_eq(ptrs[i][2499], i);
+            tfree(ptrs[i]);
+        }
+
+        talloc_heap_stats_t stats;
+        talloc_get_heap_stats(&stats);
+        ck_assert_int_eq(stats.policy, policies[p]);
+        ck_assert_uint_eq(stats.allocations, 96);
+        ck_assert_uint_eq(stats.frees, 96);
+        ck_assert_uint_ge(stats.searches + stats.quick_hits, stats.allocations);
+        ck_assert_uint_ge(stats.search_steps, stats.searches);
+        ck_assert_uint_gt(stats.splits, 0);
+    }
+}
+END_TEST
+
+START_TEST(test_heap_wilderness)
+{
+    talloc_reset_heap_stats();
+    char *prev = NULL;
+    for (int i = 0; i < 32; i++) {
+        char *ptr = tmalloc(10000 + i * 64);
+        // blocks are carved in address order from fresh system block
+        ck_assert(ptr > prev);
+        prev = ptr;
+    }
+
+    talloc_heap_stats_t stats;
+    talloc_get_heap_stats(&stats);
+    ck_assert_uint_eq(stats.carves, 32);
+    ck_assert_uint_eq(stats.splits, 0);
+
+    // freed last block merges back into wilderness and is carved again
+    const size_t size = talloc_usable_size(prev);
+    tfree(prev);
+    char *ptr = tmalloc(size + 100);
+    ck_assert_ptr_eq(ptr, prev);
+    tfree(ptr);
+}
+END_TEST
+
+static size_t pressure_calls;
+
+static void
+on_pressure(size_t allocated, size_t limit)
+{
+    ck_assert_uint_gt(allocated, 0);
+    ck_assert_uint_gt(limit, 0);
+    pressure_calls++;
+}
+
+START_TEST(test_limits)
+{
+    const size_t base = talloc_allocated();
+    talloc_set_pressure_func(on_pressure);
+    talloc_set_limits(base + 4 * TALLOC_BLOCK_SIZE, base + 8 * TALLOC_BLOCK_SIZE);
+    ck_assert_uint_eq(talloc_get_soft_limit(), base + 4 * TALLOC_BLOCK_SIZE);
+    ck_assert_uint_eq(talloc_get_hard_limit(), base + 8 * TALLOC_BLOCK_SIZE);
+
+    void *ptrs[64] = {0};
+    size_t count = 0;
+    while (count < 64 && (ptrs[count] = tmalloc(TALLOC_BLOCK_SIZE / 2)))
+        count++;
+    // hard limit stops allocation instead of abort
+    ck_assert_uint_lt(count, 64);
+    ck_assert_uint_le(talloc_allocated(), talloc_get_hard_limit());
+    ck_assert_uint_gt(pressure_calls, 0);
+    ck_assert_ptr_null(trealloc(ptrs[0], 8 * TALLOC_BLOCK_SIZE));
+    ck_assert_ptr_null(tcalloc(SIZE_MAX / 2, 4));
+
+    for (size_t i = 0; i < count; i++)
+        tfree(ptrs[i]);
+    talloc_purge();
+    talloc_heap_stats_t stats;
+    talloc_get_heap_stats(&stats);
+    ck_assert_uint_gt(stats.released_bytes, 0);
+    ck_assert_uint_lt(talloc_allocated(), talloc_get_soft_limit());
+
+    talloc_set_limits(0, 0);
+    talloc_set_pressure_func(NULL);
+}
+END_TEST
+
+typedef struct cache_object {
+    int magic;
+    int value;
+} cache_object_t;
+
+static int constructed;
+static int destroyed;
+
+static void
+construct_object(void *ptr)
+{
+    cache_object_t *obj = ptr;
+    obj->magic = 0xCAFE;
+    obj->value = 0;
+    constructed++;
+}
+
+static void
+destroy_object(void *ptr)
+{
+    cache_object_t *obj = ptr;
+    ck_assert_int_eq(obj->magic, 0xCAFE);
+    destroyed++;
+}
+
+static int reentered;
+
+// destructor which uses allocator and caches
+static void
+reenter_object(void *ptr)
+{
+    (void)ptr;
+    tfree(tmalloc(64));
+    talloc_cache_destroy(talloc_cache_create("inner", 8, 0, NULL, NULL));
+    reentered++;
+}
+
+START_TEST(test_cache)
+{
+    talloc_cache_t *cache =
+        talloc_cache_create("objects", sizeof(cache_object_t), 64, construct_object, destroy_object);
+    ck_assert_ptr_nonnull(cache);
+
+    cache_object_t *objs[100];
+    for (int i = 0; i < 100; i++) {
+        objs[i] = talloc_cache_alloc(cache);
+        ck_assert_ptr_nonnull(objs[i]);
+        ck_assert_uint_eq((uintptr_t)objs[i] % 64, 0);
+        ck_assert_int_eq(objs[i]->magic, 0xCAFE);
+        objs[i]->value = i;
+    }
+    talloc_cache_stats_t stats;
+    talloc_cache_get_stats(cache, &stats);
+    ck_assert_str_eq(stats.name, "objects");
+    ck_assert_uint_eq(stats.used, 100);
+    ck_assert_uint_eq(stats.constructed, (size_t)constructed);
+    ck_assert_uint_ge(stats.objects, 100);
+    // objects in use are never reaped
+    ck_assert_uint_eq(talloc_cache_reap(cache), 0);
+
+    // freed object keeps its state and is not constructed again
+    talloc_cache_free(cache, objs[7]);
+    const int constructed_before = constructed;
+    cache_object_t *obj = talloc_cache_alloc(cache);
+    ck_assert_ptr_eq(obj, objs[7]);
+    ck_assert_int_eq(obj->value, 7);
+    ck_assert_int_eq(constructed, constructed_before);
+
+    for (int i = 0; i < 100; i++)
+        talloc_cache_free(cache, objs[i]);
+    talloc_cache_get_stats(cache, &stats);
+    ck_assert_uint_eq(stats.used, 0);
+    ck_assert_uint_eq(stats.frees, stats.allocations);
+    const size_t slabs = stats.slab_count;
+    ck_assert_uint_gt(slabs, 0);
+    ck_assert_uint_eq(talloc_cache_reap(cache), slabs);
+    ck_assert_int_eq(destroyed, constructed);
+    talloc_cache_get_stats(cache, &stats);
+    ck_assert_uint_eq(stats.slab_count, 0);
+    ck_assert_uint_eq(stats.reaped_slabs, slabs);
+
+    // empty slabs are reaped under memory pressure too
+    talloc_cache_free(cache, talloc_cache_alloc(cache));
+    talloc_purge();
+    talloc_cache_get_stats(cache, &stats);
+    ck_assert_uint_eq(stats.slab_count, 0);
+    talloc_cache_destroy(cache);
+
+    // destructors run with no allocator lock held
+    cache = talloc_cache_create("reentrant", 32, 0, NULL, reenter_object);
+    talloc_cache_free(cache, talloc_cache_alloc(cache));
+    talloc_purge();
+    ck_assert_int_gt(reentered, 0);
+    talloc_cache_destroy(cache);
+}
+END_TEST
+
+#if TALLOC_USE_POOLS
+static size_t
+slab_count(void)
+{
+    talloc_snapshot_t *snapshot = talloc_snapshot_take();
+    const size_t count = snapshot->slab_count;
+    talloc_snapshot_free(snapshot);
+    return count;
+}
+#endif
+
+START_TEST(test_reserve)
+{
+    const talloc_reservation_t profile[] = {
+        {40, 1000}, {200, 300}, {0, 10}, {TALLOC_BLOCK_SIZE / 16, 32}};
+    ck_assert(talloc_reserve_profile(profile, 4));
+    ck_assert(talloc_reserve(40, 500));
+    const size_t allocated = talloc_allocated();
+#if TALLOC_USE_POOLS
+    const size_t slabs = slab_count();
+#endif
+
+    // steady state never grows heap nor creates slabs
+    void *ptrs[1332];
+    size_t count = 0;
+    for (size_t i = 0; i < sizeof(profile) / sizeof(profile[0]); i++) {
+        for (size_t j = 0; profile[i].size && j < profile[i].count; j++)
+            ptrs[count++] = tmalloc(profile[i].size);
+    }
+    ck_assert_uint_eq(talloc_allocated(), allocated);
+#if TALLOC_USE_POOLS
+    ck_assert_uint_eq(slab_count(), slabs);
+#endif
+    for (size_t i = 0; i < count; i++)
+        tfree(ptrs[i]);
+    ck_assert(!talloc_reserve(TALLOC_BLOCK_SIZE, SIZE_MAX / 4));
+#if TALLOC_HUGE_SIZE
+    // huge chunks are mapped on demand, heap space is not reserved for them
+    ck_assert(talloc_reserve(TALLOC_HUGE_SIZE, 64));
+    ck_assert_uint_eq(talloc_allocated(), allocated);
+#endif
+}
+END_TEST
+
+#if TALLOC_HUGE_SIZE
+START_TEST(test_huge)
+{
+    talloc_heap_stats_t before, after;
+    talloc_get_heap_stats(&before);
+    const size_t allocated = talloc_allocated();
+
+    char *huge = (char *)tmalloc(TALLOC_HUGE_SIZE + 100);
+    ck_assert_ptr_nonnull(huge);
+    ck_assert(talloc_owns(huge));
+    ck_assert_uint_ge(talloc_usable_size(huge), TALLOC_HUGE_SIZE + 100);
+    memset(huge, 1, TALLOC_HUGE_SIZE + 100);
+    ck_assert_uint_gt(talloc_allocated(), allocated);
+    tfree(huge);
+
+    huge = (char *)tmalloc(TALLOC_HUGE_SIZE);
+    ck_assert_ptr_nonnull(huge);
+    talloc_get_heap_stats(&after);
+    ck_assert_uint_eq(after.huge_allocations - before.huge_allocations, 2);
+#if TALLOC_HUGE_CACHE_SIZE
+    ck_assert_uint_eq(after.huge_cache_hits - before.huge_cache_hits, 1);
+#endif
+    tfree(huge);
+
+    // cached chunks are unmapped by purge
+    talloc_purge();
+    ck_assert(!talloc_owns(huge));
+}
+END_TEST
+#endif
+
+#if TALLOC_HEAP_RESERVE && (!TALLOC_HUGE_SIZE || TALLOC_HUGE_SIZE > TALLOC_BLOCK_SIZE * 3 / 2)
+START_TEST(test_heap_range)
+{
+    talloc_heap_t *heap = talloc_heap_create();
+    ck_assert_ptr_nonnull(heap);
+
+    // second growth extends the first one in place
+    char *first = (char *)talloc_heap_malloc(heap, TALLOC_BLOCK_SIZE * 3 / 4);
+    char *second = (char *)talloc_heap_malloc(heap, TALLOC_BLOCK_SIZE * 3 / 4);
+    ck_assert_ptr_nonnull(first);
+    ck_assert_ptr_nonnull(second);
+    ck_assert_uint_gt((uintptr_t)second, (uintptr_t)first);
+    ck_assert_uint_lt((uintptr_t)(second - first), TALLOC_BLOCK_SIZE);
+
+    // free space coalesces across growth boundary
+    talloc_heap_free(heap, first);
+    talloc_heap_free(heap, second);
+    char *joined = (char *)talloc_heap_malloc(heap, TALLOC_BLOCK_SIZE * 3 / 2);
+    ck_assert_ptr_eq(joined, first);
+    talloc_heap_free(heap, joined);
+    talloc_heap_destroy(heap);
+}
+END_TEST
+#endif
+
+START_TEST(test_heap_instances)
+{
+    const size_t allocated = talloc_allocated();
+    talloc_heap_t *first = talloc_heap_create();
+    talloc_heap_t *second = talloc_heap_create();
+    ck_assert_ptr_nonnull(first);
+    ck_assert_ptr_nonnull(second);
+    talloc_heap_set_policy(second, TALLOC_POLICY_FIRST_FIT);
+
+    void *small[64];
+    void *big[8];
+    for (int i = 0; i < 64; i++) {
+        small[i] = talloc_heap_malloc(i % 2 ? first : second, 40);
+        ck_assert_ptr_nonnull(small[i]);
+        ck_assert(talloc_owns(small[i]));
+        memset(small[i], i, 40);
+    }
+    for (int i = 0; i < 8; i++) {
+        big[i] = talloc_heap_malloc(i % 2 ? first : second, TALLOC_BLOCK_SIZE / 4);
+        ck_assert_ptr_nonnull(big[i]);
+        ck_assert_uint_ge(talloc_usable_size(big[i]), TALLOC_BLOCK_SIZE / 4);
+    }
+    // instances never touch global heap
+    ck_assert_uint_eq(talloc_allocated(), allocated);
+
+    talloc_heap_stats_t stats;
+    talloc_heap_get_stats(second, &stats);
+    ck_assert_int_eq(stats.policy, TALLOC_POLICY_FIRST_FIT);
+    ck_assert_uint_gt(stats.allocations, 4);
+    talloc_get_heap_stats(&stats);
+    ck_assert_int_eq(stats.policy, TALLOC_HEAP_POLICY);
+
+    for (int i = 0; i < 64; i++) {
+        const unsigned char *bytes = small[i];
+        ck_assert_uint_eq(bytes[39], (unsigned char)i);
+        talloc_heap_free(i % 2 ? first : second, small[i]);
+    }
+    for (int i = 0; i < 8; i += 2)
+        talloc_heap_free(second, big[i]);
+    talloc_heap_destroy(second);
+    // blocks still allocated are released with heap
+    talloc_heap_destroy(first);
+    ck_assert_uint_eq(talloc_allocated(), allocated);
+}
+END_TEST
+
+#if TALLOC_USE_POOLS && TALLOC_POOL_BITMAP
+START_TEST(test_pool_bitmap)
+{
+    talloc_heap_t *heap = talloc_heap_create();
+    ck_assert_ptr_nonnull(heap);
+
+    // cells of fresh slab are taken in address order
+    void *cells[100];
+    for (int i = 0; i < 100; i++) {
+        cells[i] = talloc_heap_malloc(heap, 100);
+        ck_assert_ptr_nonnull(cells[i]);
+        if (i)
+            ck_assert_uint_gt((uintptr_t)cells[i], (uintptr_t)cells[i - 1]);
+    }
+    // lowest free cell is reused first, not the last freed one
+    talloc_heap_free(heap, cells[5]);
+    talloc_heap_free(heap, cells[10]);
+    ck_assert_ptr_eq(talloc_heap_malloc(heap, 100), cells[5]);
+    ck_assert_ptr_eq(talloc_heap_malloc(heap, 100), cells[10]);
+
+    for (int i = 0; i < 100; i++)
+        talloc_heap_free(heap, cells[i]);
+    talloc_heap_destroy(heap);
+}
+END_TEST
+#endif
+
+START_TEST(test_mark_rewind)
+{
+    talloc_heap_t *heap = talloc_heap_create();
+    ck_assert_ptr_nonnull(heap);
+    talloc_heap_set_policy(heap, TALLOC_POLICY_BEST_FIT);
+    char *small = talloc_heap_malloc(heap, 24);
+    char *big = talloc_heap_malloc(heap, TALLOC_BLOCK_SIZE / 8);
+    strcpy(small, "small");
+    strcpy(big, "big");
+
+    talloc_mark_t *mark = talloc_mark(heap);
+    ck_assert_ptr_nonnull(mark);
+    void *first = talloc_heap_malloc(heap, TALLOC_BLOCK_SIZE / 4);
+    for (int i = 0; i < 1000; i++)
+        ck_assert_ptr_nonnull(talloc_heap_malloc(heap, (size_t)(i % 50) * 16 + 8));
+    // nested mark is released by rewind of outer one
+    ck_assert_ptr_nonnull(talloc_mark(heap));
+    for (int i = 0; i < 8; i++)
+        ck_assert_ptr_nonnull(talloc_heap_malloc(heap, TALLOC_BLOCK_SIZE / 2));
+    talloc_rewind(mark);
+
+    // state at mark is restored so the same block is found again
+    ck_assert_ptr_eq(talloc_heap_malloc(heap, TALLOC_BLOCK_SIZE / 4), first);
+    ck_assert_str_eq(small, "small");
+    ck_assert_str_eq(big, "big");
+
+    mark = talloc_mark(heap);
+    char *cells[100];
+    for (int i = 0; i < 100; i++) {
+        cells[i] = talloc_heap_malloc(heap, 24);
+        ck_assert_ptr_nonnull(cells[i]);
+        ck_assert_ptr_ne(cells[i], small);
+        memset(cells[i], 0, 24);
+    }
+    talloc_rewind(mark);
+    ck_assert_str_eq(small, "small");
+
+    // cells allocated before mark and freed after it are set aside until
+    // rewind of the oldest mark newer than them, then reused without new slab
+    char *old[64];
+    for (int i = 0; i < 64; i++)
+        ck_assert_ptr_nonnull(old[i] = talloc_heap_malloc(heap, 40));
+    mark = talloc_mark(heap);
+    talloc_mark_t *inner = talloc_mark(heap);
+    ck_assert_ptr_nonnull(inner);
+    for (int i = 0; i < 64; i++)
+        talloc_heap_free(heap, old[i]);
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < 256; i++) {
+            char *cell = talloc_heap_malloc(heap, 40);
+            for (int j = 0; j < 64; j++)
+                ck_assert_ptr_ne(cell, old[j]);
+        }
+        if (!round)
+            talloc_rewind(inner);
+    }
+    talloc_rewind(mark);
+    talloc_heap_stats_t before, after;
+    talloc_heap_get_stats(heap, &before);
+    int found = 0;
+    for (int i = 0; i < 100000 && found < 64; i++) {
+        char *cell = talloc_heap_malloc(heap, 40);
+        for (int j = 0; j < 64; j++)
+            found += cell == old[j];
+    }
+    talloc_heap_get_stats(heap, &after);
+    ck_assert_int_eq(found, 64);
+    ck_assert_uint_eq(after.allocations, before.allocations);
+
+    talloc_heap_free(heap, small);
+    talloc_heap_free(heap, big);
+    talloc_heap_destroy(heap);
+}
+END_TEST
+
+#ifndef _WIN32
+START_TEST(test_shared)
+{
+    talloc_shared_t *shared = talloc_shared_create(NULL, 1024 * 1024);
+    ck_assert_ptr_nonnull(shared);
+
+    // child process allocates, parent reads and frees
+    int fds[2];
+    ck_assert_int_eq(pipe(fds), 0);
+    const pid_t pid = fork();
+    if (pid == 0) {
+        char *text = talloc_shared_malloc(shared, 64);
+        strcpy(text, "from child");
+        const size_t offset = talloc_shared_offset(shared, text);
+        _exit(write(fds[1], &offset, sizeof(offset)) != sizeof(offset));
+    }
+    size_t offset = 0;
+    ck_assert_int_eq(read(fds[0], &offset, sizeof(offset)), sizeof(offset));
+    int status = 0;
+    waitpid(pid, &status, 0);
+    ck_assert_int_eq(status, 0);
+    close(fds[0]);
+    close(fds[1]);
+    char *text = talloc_shared_pointer(shared, offset);
+    ck_assert_str_eq(text, "from child");
+    talloc_shared_free(shared, text);
+
+    // region is reusable as whole after all blocks are freed
+    void *blocks[1024];
+    size_t count = 0;
+    while (count < 1024 && (blocks[count] = talloc_shared_malloc(shared, 4000)))
+        count++;
+    ck_assert_uint_lt(count, 1024);
+    for (size_t i = 0; i < count; i += 2)
+        talloc_shared_free(shared, blocks[i]);
+    for (size_t i = 1; i < count; i += 2)
+        talloc_shared_free(shared, blocks[i]);
+    void *big = talloc_shared_malloc(shared, 1000 * 1024);
+    ck_assert_ptr_nonnull(big);
+    talloc_shared_free(shared, big);
+    ck_assert_ptr_null(talloc_shared_malloc(shared, SIZE_MAX - 8));
+    ck_assert_ptr_null(talloc_shared_malloc(shared, 2 * 1024 * 1024));
+
+    // another mapping of the same object sees the same blocks at the same offsets
+    talloc_shared_t *other = talloc_shared_attach(talloc_shared_fd(shared));
+    ck_assert_ptr_nonnull(other);
+    text = talloc_shared_malloc(other, 16);
+    strcpy(text, "mapped twice");
+    offset = talloc_shared_offset(other, text);
+    ck_assert_ptr_ne(talloc_shared_pointer(shared, offset), text);
+    ck_assert_str_eq(talloc_shared_pointer(shared, offset), "mapped twice");
+    talloc_shared_free(shared, talloc_shared_pointer(shared, offset));
+    talloc_shared_close(other);
+    talloc_shared_close(shared);
+
+    char name[64];
+    snprintf(name, sizeof(name), "/talloc-test-%ld", (long)getpid());
+    shared = talloc_shared_create(name, 64 * 1024);
+    ck_assert_ptr_nonnull(shared);
+    ck_assert_ptr_null(talloc_shared_create(name, 64 * 1024));
+    other = talloc_shared_open(name);
+    ck_assert_ptr_nonnull(other);
+    talloc_shared_close(other);
+    talloc_shared_close(shared);
+    shm_unlink(name);
+    ck_assert_ptr_null(talloc_shared_open(name));
+}
+END_TEST
+
+typedef struct persist_node {
+    struct persist_node *next;
+    int value;
+} persist_node_t;
+
+START_TEST(test_persist)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/talloc-test-%ld.heap", (long)getpid());
+    unlink(path);
+    // file of failed first open stays empty and is created again
+    void *taken = mmap(NULL, 4096, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ck_assert_ptr_ne(taken, MAP_FAILED);
+    ck_assert_ptr_null(talloc_persist_open(path, 256 * 1024, taken));
+    munmap(taken, 4096);
+    talloc_persist_t *persist = talloc_persist_open(path, 256 * 1024, NULL);
+    ck_assert_ptr_nonnull(persist);
+    ck_assert_ptr_null(talloc_persist_root(persist));
+    // file is locked by the first user
+    ck_assert_ptr_null(talloc_persist_open(path, 0, NULL));
+    ck_assert_ptr_null(talloc_persist_malloc(persist, SIZE_MAX - 8));
+
+    persist_node_t *list = NULL;
+    for (int i = 0; i < 100; i++) {
+        persist_node_t *node = talloc_persist_malloc(persist, sizeof(persist_node_t));
+        node->next = list;
+        node->value = i;
+        list = node;
+    }
+    talloc_persist_set_root(persist, list);
+    ck_assert(talloc_persist_sync(persist));
+    void *base = talloc_persist_base(persist);
+    talloc_persist_close(persist);
+
+    // mapped at the same base raw pointers stay valid
+    persist = talloc_persist_open(path, 0, base);
+    ck_assert_ptr_nonnull(persist);
+    ck_assert_ptr_eq(talloc_persist_base(persist), base);
+    int expected = 99;
+    for (persist_node_t *node = talloc_persist_root(persist); node; node = node->next)
+        ck_assert_int_eq(node->value, expected--);
+    ck_assert_int_eq(expected, -1);
+    ck_assert(talloc_persist_check(persist));
+    list = talloc_persist_root(persist);
+    const size_t root = (size_t)((char *)list->next - (char *)base);
+    talloc_persist_set_root(persist, list->next);
+    talloc_persist_free(persist, list);
+    talloc_persist_close(persist);
+
+    // relocated heap keeps allocator state
+    persist = talloc_persist_open(path, 0, NULL);
+    ck_assert_ptr_nonnull(persist);
+    ck_assert_ptr_eq(talloc_persist_root(persist), (char *)talloc_persist_base(persist) + root);
+    ck_assert(talloc_persist_check(persist));
+    talloc_persist_close(persist);
+
+    // damaged metadata is refused
+    FILE *file = fopen(path, "r+b");
+    ck_assert_ptr_nonnull(file);
+    const char garbage[8] = {1, 2, 3, 4};
+    fseek(file, 24, SEEK_SET);
+    fwrite(garbage, 1, sizeof(garbage), file);
+    fclose(file);
+    ck_assert_ptr_null(talloc_persist_open(path, 0, NULL));
+    unlink(path);
+}
+END_TEST
+
+static void *
+maintenance_worker(void *arg)
+{
+    (void)arg;
+    void *ptrs[512];
+    for (int i = 0; i < 512; i++)
+        ptrs[i] = tmalloc(700);
+    for (int i = 0; i < 512; i++)
+        tfree(ptrs[i]);
+    return NULL;
+}
+
+START_TEST(test_maintenance)
+{
+    ck_assert(talloc_maintenance_start(2));
+    ck_assert(!talloc_maintenance_start(2));
+
+    // cells of thread cache are returned when thread exits
+    pthread_t thread;
+    pthread_create(&thread, NULL, maintenance_worker, NULL);
+    pthread_join(thread, NULL);
+    void *big = tmalloc(TALLOC_BLOCK_SIZE / 2);
+    void *guard = tmalloc(TALLOC_BLOCK_SIZE / 4);
+    tfree(big);
+
+    talloc_maintenance_stats_t stats = {0};
+    talloc_heap_stats_t heap_stats = {0};
+    for (int i = 0; i < 1000; i++) {
+        talloc_get_maintenance_stats(&stats);
+        talloc_get_heap_stats(&heap_stats);
+        if (stats.released_slabs && heap_stats.purged_bytes + heap_stats.released_bytes)
+            break;
+        usleep(2000);
+    }
+    talloc_maintenance_stop();
+    talloc_maintenance_stop();
+
+    ck_assert_uint_gt(stats.passes, 0);
+#if TALLOC_USE_POOLS
+    ck_assert_uint_gt(stats.released_slabs, 0);
+#endif
+    // free tail of heap range is decommitted instead of purged
+    ck_assert_uint_gt(heap_stats.purged_bytes + heap_stats.released_bytes, 0);
+    ck_assert_uint_eq(stats.allocated, talloc_allocated());
+    ck_assert_uint_gt(stats.largest_free, 0);
+    tfree(guard);
+}
+END_TEST
+#endif
+
+START_TEST(test_snapshot)
+{
+    void *small = tmalloc(64);
+    void *large_a = tmalloc(64 * 1024);
+    void *large_b = tmalloc(64 * 1024);
+    void *large_c = tmalloc(64 * 1024);
+    tfree(large_b);
+
+    talloc_snapshot_t *snapshot = talloc_snapshot_take();
+    ck_assert_ptr_nonnull(snapshot);
+    ck_assert_uint_ge(snapshot->block_count, 4);
+#if TALLOC_USE_POOLS
+    ck_assert_uint_ge(snapshot->slab_count, 1);
+#endif
+    ck_assert_uint_gt(snapshot->free_bytes, 64 * 1024);
+    ck_assert_uint_le(snapshot->largest_free, snapshot->free_bytes);
+    ck_assert(snapshot->fragmentation > 0.0 && snapshot->fragmentation < 1.0);
+
+    size_t total = 0, free_blocks = 0, histogram_blocks = 0;
+    for (size_t i = 0; i < snapshot->block_count; i++) {
+        total += snapshot->blocks[i].size;
+        free_blocks += !snapshot->blocks[i].used;
+    }
+    for (size_t i = 0; i < TALLOC_HISTOGRAM_SIZE; i++)
+        histogram_blocks += snapshot->histogram[i];
+    ck_assert_uint_eq(total, snapshot->allocated);
+    ck_assert_uint_eq(histogram_blocks, free_blocks);
+
+#if TALLOC_USE_POOLS
+    size_t used_cells = 0;
+    for (size_t i = 0; i < snapshot->slab_count; i++)
+        used_cells += snapshot->slabs[i].used_cells;
+    ck_assert_uint_eq(used_cells, 1);
+#endif
+
+    FILE *file = tmpfile();
+    ck_assert_int_eq(talloc_snapshot_write_json(snapshot, file), 0);
+    rewind(file);
+    ck_assert_int_eq(fgetc(file), '{');
+    fclose(file);
+
+    file = tmpfile();
+    ck_assert_int_eq(talloc_snapshot_write_binary(snapshot, file), 0);
+    fclose(file);
+
+    talloc_snapshot_free(snapshot);
+    tfree(small);
+    tfree(large_a);
+    tfree(large_c);
+}
+END_TEST
+
+#if TALLOC_PROFILING
+START_TEST(test_profile_dump)
+{
+    enum { COUNT = 1024 };
+    static void *ptrs[COUNT];
+    for (int i = 0; i < COUNT; i++)
+        ptrs[i] = tmalloc(4096);
+
+    char buf[64] = {0};
+    FILE *file = tmpfile();
+    ck_assert_int_eq(talloc_profile_dump(fileno(file)), 0);
+    rewind(file);
+    ck_assert_ptr_nonnull(fgets(buf, sizeof(buf), file));
+    ck_assert_int_eq(strncmp(buf, "heap profile: ", 14), 0);
+    ck_assert_int_ne(strncmp(buf, "heap profile: 0: 0 ", 19), 0);
+    fclose(file);
+
+    for (int i = 0; i < COUNT; i++)
+        tfree(ptrs[i]);
+
+    file = tmpfile();
+    ck_assert_int_eq(talloc_profile_dump(fileno(file)), 0);
+    rewind(file);
+    ck_assert_ptr_nonnull(fgets(buf, sizeof(buf), file));
+    ck_assert_int_eq(strncmp(buf, "heap profile: 0: 0 ", 19), 0);
+    fclose(file);
+}
+END_TEST
+#endif
+
+#if TALLOC_TRACE
+START_TEST(test_trace)
+{
+    char path[] = "talloc_trace_XXXXXX";
+    close(mkstemp(path));
+    ck_assert_int_eq(talloc_trace_start(path), 0);
+    void *mem = tmalloc(100);
+    mem = trealloc(mem, 5000);
+    tfree(mem);
+    talloc_trace_stop();
+
+    FILE *file = fopen(path, "rb");
+    ck_assert_ptr_nonnull(file);
+    char magic[8];
+    uint32_t header[2];
+    ck_assert_int_eq(fread(magic, sizeof(magic), 1, file), 1);
+    ck_assert_int_eq(fread(header, sizeof(header), 1, file), 1);
+    ck_assert_int_eq(memcmp(magic, TALLOC_TRACE_MAGIC, sizeof(magic)), 0);
+    ck_assert_uint_eq(header[1], sizeof(talloc_trace_record_t));
+
+    talloc_trace_record_t records[4];
+    ck_assert_int_eq(fread(records, sizeof(talloc_trace_record_t), 4, file), 3);
+    ck_assert_uint_eq(records[0].op, TALLOC_TRACE_MALLOC);
+    ck_assert_uint_eq(records[0].size, 100);
+    ck_assert_uint_eq(records[1].op, TALLOC_TRACE_REALLOC);
+    ck_assert_uint_eq(records[1].old_id, records[0].id);
+    ck_assert_uint_eq(records[2].op, TALLOC_TRACE_FREE);
+    ck_assert_uint_eq(records[2].id, records[1].id);
+    ck_assert_uint_le(records[0].time, records[1].time);
+    fclose(file);
+    remove(path);
+}
+END_TEST
+#endif
+
+START_TEST(test_latency)
+{
+    for (size_t i = 1; i < TALLOC_LATENCY_BUCKETS; i++)
+        ck_assert_uint_gt(talloc_latency_bucket_value(i), talloc_latency_bucket_value(i - 1));
+
+    talloc_latency_histogram_t histogram;
+    memset(&histogram, 0, sizeof(histogram));
+    ck_assert_uint_eq(talloc_latency_percentile(&histogram, 99.0), 0);
+    // 90 calls of 3 ticks and 10 calls of 100 ticks
+    histogram.count = 100;
+    histogram.min = 3;
+    histogram.max = 100;
+    histogram.buckets[3] = 90;
+    for (size_t i = 0; i < TALLOC_LATENCY_BUCKETS; i++) {
+        if (talloc_latency_bucket_value(i + 1) > 100) {
+            histogram.buckets[i] = 10;
+            break;
+        }
+    }
+    ck_assert_uint_eq(talloc_latency_percentile(&histogram, 50.0), 3);
+    ck_assert_uint_eq(talloc_latency_percentile(&histogram, 90.0), 3);
+    ck_assert_uint_eq(talloc_latency_percentile(&histogram, 99.0), 100);
+
+#if TALLOC_LATENCY_STATS
+    talloc_reset_latency();
+    for (int i = 0; i < 100; i++)
+        tfree(tmalloc(TALLOC_SMALL_TO + 1));
+    void *mem = tmalloc(16);
+    mem = trealloc(mem, 32);
+    tfree(mem);
+
+    uint64_t mallocs = 0, frees = 0;
+    for (int path = 0; path < TALLOC_PATH_COUNT; path++) {
+        talloc_get_latency(TALLOC_LATENCY_MALLOC, (talloc_latency_path_t)path, &histogram);
+        mallocs += histogram.count;
+        talloc_get_latency(TALLOC_LATENCY_FREE, (talloc_latency_path_t)path, &histogram);
+        frees += histogram.count;
+    }
+    ck_assert_uint_eq(mallocs, 101);
+    ck_assert_uint_eq(frees, 101);
+    talloc_get_latency(TALLOC_LATENCY_FREE, TALLOC_PATH_HEAP, &histogram);
+    ck_assert_uint_ge(histogram.count, 100);
+    ck_assert_uint_le(histogram.min, histogram.max);
+    ck_assert_uint_le(talloc_latency_percentile(&histogram, 50.0), histogram.max);
+
+    talloc_reset_latency();
+    talloc_get_latency(TALLOC_LATENCY_FREE, TALLOC_PATH_HEAP, &histogram);
+    ck_assert_uint_eq(histogram.count, 0);
+#endif
 }
 END_TEST
 
@@ -70,6 +1123,48 @@ talloc_suite(void)
     // test cases
     TCase *tcase = tcase_create("test_allocation");
     tcase_add_test(tcase, test_allocation);
+    tcase_add_test(tcase, test_threads);
+    tcase_add_test(tcase, test_threads_exchange);
+#if TALLOC_USE_POOLS
+    tcase_add_test(tcase, test_optimize_race);
+#endif
+    tcase_add_test(tcase, test_ownership);
+#if TALLOC_HEAP_QUICK_BINS
+    tcase_add_test(tcase, test_heap_quick_reuse);
+#endif
+    tcase_add_test(tcase, test_size_class);
+    tcase_add_test(tcase, test_inline_fast_path);
+    tcase_add_test(tcase, test_heap_policies);
+    tcase_add_test(tcase, test_heap_wilderness);
+    tcase_add_test(tcase, test_limits);
+    tcase_add_test(tcase, test_cache);
+    tcase_add_test(tcase, test_heap_instances);
+#if TALLOC_HEAP_RESERVE && (!TALLOC_HUGE_SIZE || TALLOC_HUGE_SIZE > TALLOC_BLOCK_SIZE * 3 / 2)
+    tcase_add_test(tcase, test_heap_range);
+#endif
+    tcase_add_test(tcase, test_reserve);
+#if TALLOC_HUGE_SIZE
+    tcase_add_test(tcase, test_huge);
+#endif
+#if TALLOC_USE_POOLS && TALLOC_POOL_BITMAP
+    tcase_add_test(tcase, test_pool_bitmap);
+#endif
+    tcase_add_test(tcase, test_mark_rewind);
+#ifndef _WIN32
+    tcase_add_test(tcase, test_shared);
+    tcase_add_test(tcase, test_persist);
+#endif
+#ifndef _WIN32
+    tcase_add_test(tcase, test_maintenance);
+#endif
+    tcase_add_test(tcase, test_snapshot);
+#if TALLOC_PROFILING
+    tcase_add_test(tcase, test_profile_dump);
+#endif
+#if TALLOC_TRACE
+    tcase_add_test(tcase, test_trace);
+#endif
+    tcase_add_test(tcase, test_latency);
 
     suite_add_tcase(suite, tcase);
 
@@ -0,0 +1,133 @@
+//*****************************************************************************
+// talloc
+//
+// File:   talloc_color_bench.c
+// Author: Martin Dorazil
+// Date:   19/10/2026
+//
+// Copyright 2017 Martin Dorazil
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+
+// Measure cache conflict misses of loop which reads objects placed in first
+// cells of slabs of different pool size classes.
+//
+// usage: talloc_color_bench [objects] [iterations]
+//
+// The same loop runs over objects placed at the same offset of blocks aligned
+// to TALLOC_POOL_SLAB_SIZE, which is layout of slabs without cache coloring.
+// Build talloc with TALLOC_POOL_COLORS 1 to compare with uncolored slabs.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "talloc/talloc.h"
+
+#define ALIASED_OFFSET 512
+#define CLASS_COUNT (TALLOC_SMALL_TO / TALLOC_POOL_GROUP_MULT)
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// return nanoseconds per object read
+static double
+run(uint64_t **objects, size_t count, size_t iterations)
+{
+    volatile uint64_t sink = 0;
+    uint64_t sum = 0;
+    const double begin = now();
+    for (size_t i = 0; i < iterations; i++) {
+        for (size_t j = 0; j < count; j++)
+            sum += objects[j][0];
+    }
+    const double elapsed = now() - begin;
+    sink = sum;
+    (void)sink;
+    return elapsed * 1e9 / (double)(iterations * count);
+}
+
+// count of distinct cache line offsets within page
+static size_t
+colors_used(uint64_t **objects, size_t count)
+{
+    size_t used = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t j = 0;
+        const uintptr_t line = ((uintptr_t)objects[i] % 4096) / TALLOC_CACHE_LINE_SIZE;
+        while (j < i && ((uintptr_t)objects[j] % 4096) / TALLOC_CACHE_LINE_SIZE != line)
+            j++;
+        used += j == i;
+    }
+    return used;
+}
+
+int
+main(int argc, char *argv[])
+{
+    size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 48;
+    const size_t iterations = argc > 2 ? strtoul(argv[2], NULL, 10) : 2000000;
+    if (count < 1 || count >= CLASS_COUNT) {
+        fprintf(stderr, "objects must be between 1 and %d\n", CLASS_COUNT - 1);
+        return 1;
+    }
+
+    // every size class has its own slabs, first allocation is first cell
+    uint64_t **colored = malloc(count * sizeof(uint64_t *));
+    uint64_t **aliased = malloc(count * sizeof(uint64_t *));
+    void **blocks = malloc(count * sizeof(void *));
+    if (!colored || !aliased || !blocks)
+        return 1;
+    for (size_t i = 0; i < count; i++) {
+        colored[i] = talloc_class_malloc(i + 1);
+        if (!colored[i] || posix_memalign(&blocks[i], TALLOC_POOL_SLAB_SIZE, TALLOC_POOL_SLAB_SIZE))
+            return 1;
+        aliased[i] = (uint64_t *)((char *)blocks[i] + ALIASED_OFFSET);
+        colored[i][0] = aliased[i][0] = i;
+    }
+
+    // warm up
+    run(colored, count, iterations / 10);
+    run(aliased, count, iterations / 10);
+    const double colored_ns = run(colored, count, iterations);
+    const double aliased_ns = run(aliased, count, iterations);
+
+    printf("objects:        %zu\n", count);
+    printf("slab colors:    %d\n", TALLOC_POOL_COLORS);
+    printf("talloc:         %.3f ns/read, %zu cache line offsets\n", colored_ns,
+           colors_used(colored, count));
+    printf("aliased:        %.3f ns/read, %zu cache line offsets\n", aliased_ns,
+           colors_used(aliased, count));
+
+    for (size_t i = 0; i < count; i++) {
+        talloc_class_free(colored[i], i + 1);
+        free(blocks[i]);
+    }
+    free(colored);
+    free(aliased);
+    free(blocks);
+    return 0;
+}
@@ -0,0 +1,340 @@
+//*****************************************************************************
+// talloc
+//
+// File:   talloc_replay.c
+// Author: Martin Dorazil
+// Date:   19/10/2026
+//
+// Copyright 2017 Martin Dorazil
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//*****************************************************************************
+
+// Replay allocation trace recorded by talloc_trace_start against talloc or
+// system allocator.
+//
+// usage: talloc_replay <trace file> [talloc|system]
+//
+// Every recorded thread is replayed by its own thread in recorded order, frees
+// and reallocs wait until allocation of the same pointer id is replayed.
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include "talloc/talloc.h"
+
+#define NO_DEP SIZE_MAX
+
+typedef struct backend {
+    const char *name;
+    void *(*malloc_f)(size_t);
+    void *(*realloc_f)(void *, size_t);
+    void (*free_f)(void *);
+} backend_t;
+
+typedef struct entry {
+    talloc_trace_record_t record;
+    // index in file, keeps per-thread order for records with same time
+    size_t index;
+    // index of entry which allocated pointer consumed by this entry
+    size_t dep;
+    void *ptr;
+    atomic_bool done;
+} entry_t;
+
+typedef struct replay_thread {
+    pthread_t handle;
+    uint32_t id;
+    size_t *entries;
+    size_t count;
+    size_t capacity;
+} replay_thread_t;
+
+static const backend_t backends[] = {
+    {"talloc", tmalloc, trealloc, tfree},
+    {"system", malloc, realloc, free},
+};
+
+static entry_t *entries;
+static size_t entry_count;
+static replay_thread_t *threads;
+static size_t thread_count;
+static const backend_t *backend;
+static atomic_size_t live_bytes;
+static atomic_size_t peak_bytes;
+static atomic_bool start;
+
+static int
+compare_entries(const void *a, const void *b)
+{
+    const entry_t *ea = (const entry_t *)a;
+    const entry_t *eb = (const entry_t *)b;
+    if (ea->record.time != eb->record.time)
+        return ea->record.time < eb->record.time ? -1 : 1;
+    return (ea->index > eb->index) - (ea->index < eb->index);
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static bool
+load_trace(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "cannot open trace file '%s'\n", path);
+        return false;
+    }
+
+    char magic[8];
+    uint32_t header[2];
+    if (fread(magic, sizeof(magic), 1, file) != 1 || fread(header, sizeof(header), 1, file) != 1 ||
+        memcmp(magic, TALLOC_TRACE_MAGIC, sizeof(magic)) != 0) {
+        fprintf(stderr, "'%s' is not talloc trace file\n", path);
+        fclose(file);
+        return false;
+    }
+    if (header[0] != TALLOC_TRACE_VERSION || header[1] != sizeof(talloc_trace_record_t)) {
+        fprintf(stderr, "unsupported trace version %u\n", header[0]);
+        fclose(file);
+        return false;
+    }
+
+    size_t capacity = 1024;
+    entries = malloc(capacity * sizeof(entry_t));
+    talloc_trace_record_t record;
+    while (fread(&record, sizeof(record), 1, file) == 1) {
+        if (entry_count == capacity) {
+            capacity *= 2;
+            entries = realloc(entries, capacity * sizeof(entry_t));
+        }
+        entry_t *entry = &entries[entry_count];
+        entry->record = record;
+        entry->index = entry_count++;
+    }
+    fclose(file);
+
+    qsort(entries, entry_count, sizeof(entry_t), compare_entries);
+    return true;
+}
+
+// open addressing map from pointer id to index of entry which allocated it
+typedef struct id_map {
+    uint64_t *keys;
+    size_t *values;
+    size_t mask;
+} id_map_t;
+
+static size_t *
+id_map_slot(id_map_t *map, uint64_t key, bool insert)
+{
+    size_t i = (size_t)((key >> 4) * 0x9E3779B97F4A7C15ull) & map->mask;
+    size_t *tombstone = NULL;
+    while (map->keys[i]) {
+        if (map->keys[i] == key && map->values[i] != NO_DEP)
+            return &map->values[i];
+        if (map->values[i] == NO_DEP && !tombstone)
+            tombstone = &map->values[i];
+        i = (i + 1) & map->mask;
+    }
+    if (!insert)
+        return NULL;
+    if (tombstone) {
+        map->keys[tombstone - map->values] = key;
+        return tombstone;
+    }
+    map->keys[i] = key;
+    return &map->values[i];
+}
+
+static replay_thread_t *
+get_thread(uint32_t id)
+{
+    for (size_t i = 0; i < thread_count; i++) {
+        if (threads[i].id == id)
+            return &threads[i];
+    }
+    threads = realloc(threads, (thread_count + 1) * sizeof(replay_thread_t));
+    replay_thread_t *thread = &threads[thread_count++];
+    memset(thread, 0, sizeof(replay_thread_t));
+    thread->id = id;
+    return thread;
+}
+
+// resolve dependencies between entries and split them into threads
+static size_t
+prepare(void)
+{
+    size_t skipped = 0;
+    size_t capacity = 16;
+    while (capacity < entry_count * 2)
+        capacity *= 2;
+    id_map_t map = {calloc(capacity, sizeof(uint64_t)), calloc(capacity, sizeof(size_t)),
+                    capacity - 1};
+
+    for (size_t i = 0; i < entry_count; i++) {
+        entry_t *entry = &entries[i];
+        const talloc_trace_record_t *record = &entry->record;
+        entry->dep = NO_DEP;
+        atomic_init(&entry->done, false);
+
+        if (record->op == TALLOC_TRACE_FREE || record->op == TALLOC_TRACE_REALLOC) {
+            const uint64_t consumed = record->op == TALLOC_TRACE_FREE ? record->id : record->old_id;
+            size_t *slot = id_map_slot(&map, consumed, false);
+            if (slot) {
+                entry->dep = *slot;
+                // remove from map, id can be reused by allocator
+                *slot = NO_DEP;
+            } else if (record->op == TALLOC_TRACE_FREE) {
+                // pointer was allocated before recording started
+                skipped++;
+                atomic_store(&entry->done, true);
+                continue;
+            }
+        }
+
+        if (record->op != TALLOC_TRACE_FREE && record->id)
+            *id_map_slot(&map, record->id, true) = i;
+
+        replay_thread_t *thread = get_thread(record->thread);
+        if (thread->count == thread->capacity) {
+            thread->capacity = thread->capacity ? thread->capacity * 2 : 1024;
+            thread->entries = realloc(thread->entries, thread->capacity * sizeof(size_t));
+        }
+        thread->entries[thread->count++] = i;
+    }
+
+    free(map.keys);
+    free(map.values);
+    return skipped;
+}
+
+static void
+add_live(size_t size)
+{
+    const size_t live = atomic_fetch_add(&live_bytes, size) + size;
+    size_t peak = atomic_load(&peak_bytes);
+    while (live > peak && !atomic_compare_exchange_weak(&peak_bytes, &peak, live))
+        ;
+}
+
+static void *
+replay(void *arg)
+{
+    const replay_thread_t *thread = (const replay_thread_t *)arg;
+    while (!atomic_load(&start))
+        ;
+
+    for (size_t i = 0; i < thread->count; i++) {
+        entry_t *entry = &entries[thread->entries[i]];
+        const talloc_trace_record_t *record = &entry->record;
+        entry_t *dep = entry->dep != NO_DEP ? &entries[entry->dep] : NULL;
+        if (dep) {
+            while (!atomic_load(&dep->done))
+                sched_yield();
+        }
+
+        switch (record->op) {
+        case TALLOC_TRACE_MALLOC:
+            entry->ptr = backend->malloc_f(record->size);
+            add_live(record->size);
+            break;
+        case TALLOC_TRACE_REALLOC:
+            entry->ptr = backend->realloc_f(dep ? dep->ptr : NULL, record->size);
+            add_live(record->size);
+            if (dep)
+                atomic_fetch_sub(&live_bytes, dep->record.size);
+            break;
+        case TALLOC_TRACE_FREE:
+            backend->free_f(dep->ptr);
+            atomic_fetch_sub(&live_bytes, dep->record.size);
+            break;
+        default:
+            break;
+        }
+        atomic_store(&entry->done, true);
+    }
+    return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <trace file> [talloc|system]\n", argv[0]);
+        return 1;
+    }
+
+    backend = &backends[0];
+    if (argc > 2) {
+        backend = NULL;
+        for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+            if (strcmp(argv[2], backends[i].name) == 0)
+                backend = &backends[i];
+        }
+        if (!backend) {
+            fprintf(stderr, "unknown allocator '%s'\n", argv[2]);
+            return 1;
+        }
+    }
+
+    if (!load_trace(argv[1]))
+        return 1;
+    const size_t skipped = prepare();
+
+    for (size_t i = 0; i < thread_count; i++)
+        pthread_create(&threads[i].handle, NULL, replay, &threads[i]);
+
+    const double begin = now();
+    atomic_store(&start, true);
+    for (size_t i = 0; i < thread_count; i++)
+        pthread_join(threads[i].handle, NULL);
+    const double elapsed = now() - begin;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    const size_t ops = entry_count - skipped;
+    printf("allocator:      %s\n", backend->name);
+    printf("records:        %zu (%zu skipped)\n", entry_count, skipped);
+    printf("threads:        %zu\n", thread_count);
+    printf("time:           %.6f s\n", elapsed);
+    printf("throughput:     %.0f ops/s\n", elapsed > 0 ? (double)ops / elapsed : 0.0);
+    printf("peak requested: %zu B\n", atomic_load(&peak_bytes));
+    if (backend == &backends[0])
+        printf("talloc system:  %zu B\n", talloc_allocated());
+    printf("max rss:        %ld KB\n", usage.ru_maxrss);
+
+    for (size_t i = 0; i < thread_count; i++)
+        free(threads[i].entries);
+    free(threads);
+    free(entries);
+    return 0;
+}